@@ -0,0 +1,350 @@
+/**
+ * File:	Bvh.h
+ *
+ * Summary:
+ *
+ * Binary bounding volume hierarchy over a set of primitives given only by
+ * their axis aligned boxes, one primitive per leaf. build() is a linear BVH
+ * (Karras 2012): the primitives are sorted along a 30 bit Morton curve of
+ * their centroids with a parallel radix sort, and every internal node finds
+ * its own range and split in the sorted codes independently. Internal nodes
+ * come first, node i covering a range that starts or ends at sorted leaf i,
+ * then the leaves in Morton order. All scratch is kept, so rebuilding the
+ * same number of primitives doesn't allocate. refit() keeps the topology and
+ * recomputes the boxes bottom up in parallel, which is all a deforming mesh
+ * needs as long as quality() (internal box area relative to right after the
+ * build) hasn't grown too much. selfQuery() finds the overlapping pairs of
+ * primitives by descending the tree against itself, split into a fixed set of
+ * tasks for the thread pool.
+ *
+ * The codes can also be given, when the primitives have an order of their
+ * own that matters more than where they are. Every internal node covers
+ * exactly the primitives whose codes start with some prefix, so codes that
+ * interleave the two coordinates of a grid make every node a rectangle of it.
+ */
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "Vec3f.h"
+#include "ThreadPool.h"
+
+struct Aabb {
+  Vec3f min, max;
+
+  static Aabb empty();
+  static Aabb around(Vec3f const &p, float radius);
+
+  void grow(Vec3f const &p);
+  void grow(Aabb const &other);
+  void inflate(float radius);
+  bool overlaps(Aabb const &other) const;
+  // Where the ray origin + t direction enters the box, if it does for some
+  // t in [0, maxT]. inverse is 1 / direction per axis.
+  bool entry(Vec3f const &origin, Vec3f const &inverse, float maxT,
+             float &t) const;
+  Vec3f centroid() const;
+  float surfaceArea() const;
+};
+
+class Bvh {
+public:
+  struct Node {
+    Aabb box;
+    int left, right;  // children, -1 on leaves
+    int parent;       // -1 on the root
+    int primitive;    // -1 on internal nodes
+  };
+
+  Bvh();
+
+  void build(std::vector<Aabb> const &boxes, ThreadPool &pool);
+  // codes of at most 30 bits, one per box and all different
+  void build(std::vector<Aabb> const &boxes,
+             std::vector<std::uint32_t> const &codes, ThreadPool &pool);
+  void refit(std::vector<Aabb> const &boxes, ThreadPool &pool);
+
+  // sum of the internal box areas over the same sum right after the build
+  float quality() const;
+
+  bool empty() const;
+  unsigned primitiveCount() const;
+  Node const &node(int i) const;
+  int root() const;
+
+  // Calls visit(primitive) for every primitive whose box overlaps box.
+  template <class Visit> void query(Aabb const &box, Visit visit) const;
+
+  // Closest hit of the ray origin + t direction with t in [0, maxT], maxT if
+  // none. hit(primitive, limit) is called for the primitives whose boxes
+  // the ray enters before limit, nearer boxes first, and returns the t of
+  // its own hit or limit for a miss; subtrees entered past the closest hit
+  // so far aren't visited.
+  template <class Hit>
+  float raycast(Vec3f const &origin, Vec3f const &direction, float maxT,
+                Hit hit) const;
+
+  // Calls visit(task, a, b) once for every pair of primitives whose boxes
+  // come within margin of each other. Tasks run in parallel; a task always
+  // reports the same pairs in the same order, so per task output is
+  // deterministic.
+  template <class Visit>
+  void selfQuery(float margin, ThreadPool &pool, Visit visit) const;
+  // The same without the pairs within the subtrees of the nodes for which
+  // skip(node) is true.
+  template <class Skip, class Visit>
+  void selfQuery(float margin, ThreadPool &pool, Skip skip,
+                 Visit visit) const;
+  unsigned selfTaskCount() const;
+
+private:
+  struct Task {
+    int a, b;  // a == b: pairs within a's subtree, else pairs across
+  };
+
+  bool allocate(unsigned count);
+  void computeCodes(std::vector<Aabb> const &boxes, ThreadPool &pool);
+  void sortCodes(ThreadPool &pool);
+  void linkNodes(ThreadPool &pool);
+  int commonPrefix(int i, int j) const;
+  void fitBoxes(std::vector<Aabb> const &boxes, ThreadPool &pool);
+  void link(std::vector<Aabb> const &boxes, ThreadPool &pool);
+  void buildTasks(int node, unsigned depth);
+  template <class Skip> bool skipped(int node, Skip &skip) const;
+  template <class Skip, class Visit>
+  void selfPairs(int node, float margin, unsigned task, Skip &skip,
+                 Visit &visit) const;
+  template <class Visit>
+  void crossPairs(int a, int b, float margin, unsigned task,
+                  Visit &visit) const;
+
+  unsigned chunkCount(unsigned items, ThreadPool &pool) const;
+  float internalArea(ThreadPool &pool);
+
+  std::vector<Node> m_nodes;
+  std::vector<int> m_leafOf;          // leaf node of every primitive
+  std::vector<Task> m_tasks;
+  std::unique_ptr<std::atomic<int>[]> m_visits;  // refit arrivals per node
+  unsigned m_visitCount;
+  float m_builtArea;
+  float m_area;                       // internal box area after the last fit
+
+  // build scratch: sorted codes and primitives, their radix sort buffers,
+  // per chunk digit counts, centroid bounds and areas
+  std::vector<std::uint32_t> m_codes, m_codesSwap;
+  std::vector<unsigned> m_sorted, m_sortedSwap;
+  std::vector<unsigned> m_digitCounts;
+  std::vector<Aabb> m_chunkBounds;
+  std::vector<float> m_chunkAreas;
+};
+
+// INLINE DEFINITIONS //
+
+inline Aabb Aabb::empty() {
+  float big = std::numeric_limits<float>::max();
+  Aabb box;
+  box.min = Vec3f(big, big, big);
+  box.max = Vec3f(-big, -big, -big);
+  return box;
+}
+
+inline Aabb Aabb::around(Vec3f const &p, float radius) {
+  Aabb box;
+  box.min = p - Vec3f(radius, radius, radius);
+  box.max = p + Vec3f(radius, radius, radius);
+  return box;
+}
+
+inline void Aabb::grow(Vec3f const &p) {
+  min = Vec3f(std::min(min.x(), p.x()), std::min(min.y(), p.y()),
+              std::min(min.z(), p.z()));
+  max = Vec3f(std::max(max.x(), p.x()), std::max(max.y(), p.y()),
+              std::max(max.z(), p.z()));
+}
+
+inline void Aabb::grow(Aabb const &other) {
+  grow(other.min);
+  grow(other.max);
+}
+
+inline void Aabb::inflate(float radius) {
+  min -= Vec3f(radius, radius, radius);
+  max += Vec3f(radius, radius, radius);
+}
+
+inline bool Aabb::overlaps(Aabb const &other) const {
+  return min.x() <= other.max.x() && other.min.x() <= max.x() &&
+         min.y() <= other.max.y() && other.min.y() <= max.y() &&
+         min.z() <= other.max.z() && other.min.z() <= max.z();
+}
+
+inline bool Aabb::entry(Vec3f const &origin, Vec3f const &inverse,
+                        float maxT, float &t) const {
+  float near = 0, far = maxT;
+  for (int axis = 0; axis < 3; axis++) {
+    float t0 = (min[axis] - origin[axis]) * inverse[axis];
+    float t1 = (max[axis] - origin[axis]) * inverse[axis];
+    near = std::max(near, std::min(t0, t1));
+    far = std::min(far, std::max(t0, t1));
+  }
+  t = near;
+  return near <= far;
+}
+
+inline Vec3f Aabb::centroid() const { return 0.5f * (min + max); }
+
+inline float Aabb::surfaceArea() const {
+  Vec3f d = max - min;
+  return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+inline bool Bvh::empty() const { return m_nodes.empty(); }
+
+inline unsigned Bvh::primitiveCount() const { return m_leafOf.size(); }
+
+inline Bvh::Node const &Bvh::node(int i) const { return m_nodes[i]; }
+
+inline int Bvh::root() const { return 0; }
+
+inline unsigned Bvh::selfTaskCount() const { return m_tasks.size(); }
+
+template <class Visit> void Bvh::query(Aabb const &box, Visit visit) const {
+  if (m_nodes.empty())
+    return;
+
+  int stack[64];
+  int top = 0;
+  stack[top++] = root();
+  while (top > 0) {
+    Node const &n = m_nodes[stack[--top]];
+    if (!n.box.overlaps(box))
+      continue;
+
+    if (n.primitive >= 0) {
+      visit(n.primitive);
+    } else {
+      stack[top++] = n.left;
+      stack[top++] = n.right;
+    }
+  }
+}
+
+template <class Hit>
+float Bvh::raycast(Vec3f const &origin, Vec3f const &direction, float maxT,
+                   Hit hit) const {
+  if (m_nodes.empty())
+    return maxT;
+
+  Vec3f inverse(1 / direction.x(), 1 / direction.y(), 1 / direction.z());
+  float closest = maxT;
+  struct Entry {
+    int node;
+    float t;
+  } stack[64];
+  int top = 0;
+  float t;
+  if (m_nodes[root()].box.entry(origin, inverse, closest, t)) {
+    Entry first = {root(), t};
+    stack[top++] = first;
+  }
+
+  while (top > 0) {
+    Entry e = stack[--top];
+    if (e.t > closest)
+      continue;
+
+    Node const &n = m_nodes[e.node];
+    if (n.primitive >= 0) {
+      closest = std::min(closest, hit(n.primitive, closest));
+      continue;
+    }
+
+    // the nearer child goes on top
+    float tLeft, tRight;
+    bool left = m_nodes[n.left].box.entry(origin, inverse, closest, tLeft);
+    bool right = m_nodes[n.right].box.entry(origin, inverse, closest, tRight);
+    Entry l = {n.left, tLeft}, r = {n.right, tRight};
+    if (left && right) {
+      stack[top++] = tLeft < tRight ? r : l;
+      stack[top++] = tLeft < tRight ? l : r;
+    } else if (left) {
+      stack[top++] = l;
+    } else if (right) {
+      stack[top++] = r;
+    }
+  }
+  return closest;
+}
+
+template <class Visit>
+void Bvh::selfQuery(float margin, ThreadPool &pool, Visit visit) const {
+  selfQuery(margin, pool, [](int) { return false; }, visit);
+}
+
+template <class Skip, class Visit>
+void Bvh::selfQuery(float margin, ThreadPool &pool, Skip skip,
+                    Visit visit) const {
+  pool.parallelFor(m_tasks.size(), [&](unsigned task) {
+    Task const &t = m_tasks[task];
+    if (t.a == t.b) {
+      if (!skipped(m_nodes[t.a].parent, skip))
+        selfPairs(t.a, margin, task, skip, visit);
+    } else if (!skipped(m_nodes[t.a].parent, skip)) {
+      crossPairs(t.a, t.b, margin, task, visit);
+    }
+  });
+}
+
+// whether node or any node above it is skipped
+template <class Skip> bool Bvh::skipped(int node, Skip &skip) const {
+  for (; node >= 0; node = m_nodes[node].parent) {
+    if (skip(node))
+      return true;
+  }
+  return false;
+}
+
+template <class Skip, class Visit>
+void Bvh::selfPairs(int node, float margin, unsigned task, Skip &skip,
+                    Visit &visit) const {
+  Node const &n = m_nodes[node];
+  if (n.primitive >= 0 || skip(node))
+    return;
+
+  selfPairs(n.left, margin, task, skip, visit);
+  selfPairs(n.right, margin, task, skip, visit);
+  crossPairs(n.left, n.right, margin, task, visit);
+}
+
+template <class Visit>
+void Bvh::crossPairs(int a, int b, float margin, unsigned task,
+                     Visit &visit) const {
+  Node const &na = m_nodes[a];
+  Node const &nb = m_nodes[b];
+  Aabb grown = na.box;
+  grown.inflate(margin);
+  if (!grown.overlaps(nb.box))
+    return;
+
+  bool leafA = na.primitive >= 0;
+  bool leafB = nb.primitive >= 0;
+  if (leafA && leafB) {
+    visit(task, na.primitive, nb.primitive);
+  } else if (leafB ||
+             (!leafA && na.box.surfaceArea() > nb.box.surfaceArea())) {
+    crossPairs(na.left, b, margin, task, visit);
+    crossPairs(na.right, b, margin, task, visit);
+  } else {
+    crossPairs(a, nb.left, margin, task, visit);
+    crossPairs(a, nb.right, margin, task, visit);
+  }
+}
+
+#endif // BVH_H
@@ -0,0 +1,230 @@
+/**
+ * File:	ClothCollision.h
+ *
+ * Summary:
+ *
+ * Self-collision detection for the lattice cloths. The lattice is split into
+ * two triangles per quad, with a Bvh over the triangles that is refit every
+ * update. It is built on codes that interleave the column and row of each
+ * quad, so every node is a rectangular patch of the lattice, and a rebuild
+ * would give the same tree. findContacts() then runs the two proximity
+ * queries of a triangle mesh, vertex against triangle and edge against edge,
+ * and reports
+ * every pair closer than the thickness that doesn't share a vertex. Both run
+ * on the triangle pairs from the self query of the hierarchy, each vertex and
+ * edge through the first triangle that has it, so no pair is tested twice.
+ *
+ * findImpacts() is the continuous version over a step from one set of
+ * positions to the next: the hierarchy is refit to the swept boxes, and a
+ * pair collides where the cubic for its four points being coplanar has a root
+ * at which the features touch. findNearImpacts() only retests the pairs in
+ * the contact cache.
+ *
+ * Both queries skip the inside of patches that can't touch themselves
+ * (Volino and Thalmann 1994). A patch qualifies when a cone of less than a
+ * right angle holds all its triangle normals, and its border, projected
+ * along the cone's axis, is star shaped around its centre (Schvartzman et
+ * al. 2010). The cones are merged bottom up and the patches tested top
+ * down. Over a step, a triangle's normal is a quadratic in time, and the
+ * cone holds the three control points of that quadratic. Each wedge of the
+ * border must keep its turn for the whole step, which its quadratic's
+ * control points also bound. The test only rules out crossings, so it also
+ * covers proximity only while the cloth isn't squashed in its own plane
+ * until features that aren't neighbours come within the thickness.
+ *
+ * Most contacts last for many steps, so findContacts() keeps every pair
+ * within the thickness plus a skin in a cache, along with where its vertices
+ * were and the impulse the response last gave it. refreshContacts() then
+ * brings the contacts up to date from the cache alone: a pair whose vertices
+ * have moved less than the tolerance relative to each other keeps its last
+ * result, any other is tested again, and one that has left the skin is
+ * dropped. The impulses let the response start each contact from the one
+ * before.
+ */
+
+#ifndef CLOTH_COLLISION_H
+#define CLOTH_COLLISION_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Vec3f.h"
+#include "Bvh.h"
+#include "ThreadPool.h"
+
+// A pair of mesh features closer than the thickness, or colliding along a
+// step. The relative position and velocity of the pair are the weighted sums
+// over the four vertices, so one response handles both kinds: a vertex
+// against a triangle has weights 1, -b0, -b1, -b2 (the barycentrics of the
+// closest point), an edge against an edge 1-s, s, -(1-t), -t. normal points
+// from the negative side to the positive one; for impacts, the side the
+// positive one came from.
+struct Contact {
+  unsigned vertex[4];
+  float weight[4];
+  Vec3f normal;
+  float depth;          // thickness minus distance, 0 for impacts
+  float time;           // of the impact as a fraction of the step
+  bool edges;           // edge-edge rather than vertex-triangle
+  unsigned feature[2];  // the vertex and triangle, or the two edges
+  float impulse;        // the response gave it last time, 0 when new
+};
+
+class ClothCollision {
+public:
+  ClothCollision();
+
+  // two triangles per quad of a row major length by width lattice
+  void setLattice(unsigned length, unsigned width);
+  void clear();
+  bool empty() const;
+
+  void setThickness(float thickness);
+  void setCache(float skin, float tolerance);
+
+  // Refits the hierarchy around the new positions, building it first for a
+  // new lattice. It is never rebuilt as it loosens: its nodes are fixed
+  // patches of the lattice, and a rebuild would give the same tree.
+  void update(std::vector<Vec3f> const &positions, ThreadPool &pool);
+  void findContacts(std::vector<Vec3f> const &positions, ThreadPool &pool);
+
+  // Contacts from the pairs the last findContacts() cached. Only finds the
+  // pairs that were within the skin then.
+  void refreshContacts(std::vector<Vec3f> const &positions);
+
+  // the impulse contact n of the last findContacts() or refreshContacts()
+  // was given, for the next response to start from
+  void setImpulse(unsigned contact, float impulse);
+
+  void findImpacts(std::vector<Vec3f> const &start,
+                   std::vector<Vec3f> const &end, ThreadPool &pool);
+  void findNearImpacts(std::vector<Vec3f> const &start,
+                       std::vector<Vec3f> const &end);
+
+  std::vector<Contact> const &contacts() const;
+  unsigned triangleCount() const;
+  unsigned edgeCount() const;
+  unsigned cachedCount() const;
+  unsigned reusedCount() const;   // untested by the last refresh
+  unsigned smoothCount() const;   // triangles the last query skipped
+
+private:
+  struct Triangle {
+    unsigned v[3];
+    unsigned edge[3];
+  };
+  struct Edge {
+    unsigned v[2];
+    unsigned owner;  // first triangle that has it
+  };
+  struct Patch {
+    unsigned column[2], row[2];  // quads [column[0], column[1]) by rows
+  };
+  struct Cone {
+    Vec3f axis;
+    float angle;  // half the opening, pi or more for any direction
+  };
+  struct CachedPair {
+    unsigned long long key;  // edges, feature[0], feature[1]
+    Contact contact;         // depth negative while apart
+    Vec3f at[4];             // the vertices when the contact was found
+  };
+
+  void buildEdges();
+  void fitHierarchy(ThreadPool &pool);
+  Patch fitPatches(int node);
+  void findSmoothPatches(std::vector<Vec3f> const &start,
+                         std::vector<Vec3f> const &end);
+  Cone fitCones(int node, std::vector<Vec3f> const &start,
+                std::vector<Vec3f> const &end);
+  void markSmooth(int node, std::vector<Vec3f> const &start,
+                  std::vector<Vec3f> const &end);
+  bool starShaped(Patch const &patch, Vec3f const &axis,
+                  std::vector<Vec3f> const &start,
+                  std::vector<Vec3f> const &end);
+  void trianglePair(std::vector<Vec3f> const &positions, unsigned a,
+                    unsigned b, float reach, std::vector<Contact> &out) const;
+  void vertexTriangle(std::vector<Vec3f> const &positions, unsigned vertex,
+                      unsigned triangle, float reach,
+                      std::vector<Contact> &out) const;
+  void edgeEdge(std::vector<Vec3f> const &positions, unsigned e, unsigned f,
+                float reach, std::vector<Contact> &out) const;
+  void sweptPair(std::vector<Vec3f> const &start,
+                 std::vector<Vec3f> const &end, unsigned a, unsigned b,
+                 std::vector<Contact> &out) const;
+  void vertexTriangleImpact(std::vector<Vec3f> const &start,
+                            std::vector<Vec3f> const &end, unsigned vertex,
+                            unsigned triangle,
+                            std::vector<Contact> &out) const;
+  void edgeEdgeImpact(std::vector<Vec3f> const &start,
+                      std::vector<Vec3f> const &end, unsigned e, unsigned f,
+                      std::vector<Contact> &out) const;
+  void gatherContacts();
+  void cache(std::vector<Vec3f> const &positions, Contact const &contact,
+             CachedPair &pair) const;
+  void publishCache();
+
+  std::vector<Triangle> m_triangles;
+  std::vector<Edge> m_edges;
+  std::vector<unsigned> m_vertexOwner;  // first triangle that has the vertex
+  unsigned m_vertexCount;
+  unsigned m_length;                    // lattice vertices per row
+  float m_thickness;
+  float m_impactTolerance;  // how close a coplanar pair has to be to touch
+  float m_skin;
+  float m_tolerance;        // relative motion that gets a pair retested
+  unsigned m_reused;
+
+  Bvh m_bvh;
+  std::vector<std::uint32_t> m_codes;   // lattice order of every triangle
+  std::vector<Aabb> m_boxes;
+  std::vector<Patch> m_patches;         // of every node
+  std::vector<Cone> m_cones;
+  std::vector<char> m_smooth;           // node can't touch itself
+  unsigned m_smoothTriangles;
+  std::vector<unsigned> m_contour;      // scratch of starShaped()
+  std::vector<float> m_projected;
+  std::vector<std::vector<Contact> > m_chunkContacts;
+  std::vector<Contact> m_contacts;
+  std::vector<CachedPair> m_cache;      // in order of key
+  std::vector<unsigned> m_contactPair;  // of every contact
+  std::vector<Contact> m_retest;
+};
+
+// INLINE DEFINITIONS //
+
+inline bool ClothCollision::empty() const { return m_triangles.empty(); }
+
+inline void ClothCollision::setThickness(float thickness) {
+  m_thickness = thickness;
+  m_impactTolerance = 0.05f * thickness;
+}
+
+inline void ClothCollision::setCache(float skin, float tolerance) {
+  m_skin = skin;
+  m_tolerance = tolerance;
+}
+
+inline void ClothCollision::setImpulse(unsigned contact, float impulse) {
+  m_cache[m_contactPair[contact]].contact.impulse = impulse;
+}
+
+inline std::vector<Contact> const &ClothCollision::contacts() const {
+  return m_contacts;
+}
+
+inline unsigned ClothCollision::triangleCount() const {
+  return m_triangles.size();
+}
+
+inline unsigned ClothCollision::edgeCount() const { return m_edges.size(); }
+
+inline unsigned ClothCollision::cachedCount() const { return m_cache.size(); }
+
+inline unsigned ClothCollision::reusedCount() const { return m_reused; }
+
+inline unsigned ClothCollision::smoothCount() const {
+  return m_smoothTriangles;
+}
+
+#endif // CLOTH_COLLISION_H
@@ -0,0 +1,194 @@
+/**
+ * File:	Collider.h
+ *
+ * Summary:
+ *
+ * Static obstacles as signed distance fields: analytic planes, boxes, spheres
+ * and capsules, and voxel grids baked from closed triangle meshes. A
+ * ColliderSet works on a ColliderBatch, the moving masses held as structure
+ * of arrays, and goes through it one collider at a time. The loop over the
+ * masses is the same for every mass of a collider, with selects in place of
+ * branches, so it vectorises, and another obstacle costs one more pass
+ * rather than another code path.
+ */
+
+#ifndef COLLIDER_H
+#define COLLIDER_H
+
+#include <vector>
+
+#include "Vec3f.h"
+
+// How a mass leaves an obstacle. Velocity is split along the obstacle's
+// normal; a bounce reflects the normal part, and one that comes out slower
+// than restSpeed leaves the mass resting on the surface instead.
+struct ColliderMaterial {
+  float restitution;  // normal speed kept by a bounce
+  float slip;         // tangential velocity kept by a bounce
+  float restSlip;     // tangential velocity kept when coming to rest
+  float restSpeed;
+};
+
+// Signed distance to a closed mesh, sampled at the nodes of a regular grid
+// and interpolated trilinearly in between. Away from the grid the distance
+// to it is added on, which keeps the field an upper bound of the true one.
+class VoxelSdf {
+public:
+  VoxelSdf();
+
+  // Samples the mesh (three indices per triangle) on nodes cellSize apart,
+  // covering its bounds grown by margin. The sign comes from the winding
+  // number, so the mesh has to be closed and consistently wound, either way
+  // round.
+  void bake(std::vector<Vec3f> const &vertices,
+            std::vector<unsigned> const &indices, float cellSize,
+            float margin);
+
+  bool empty() const;
+  Vec3f const &origin() const;
+  float cellSize() const;
+  unsigned nodes(int axis) const;
+  float value(unsigned x, unsigned y, unsigned z) const;
+  float const *values() const;
+
+private:
+  Vec3f m_origin;
+  float m_cellSize;
+  unsigned m_nodes[3];
+  std::vector<float> m_values;  // x fastest
+};
+
+// The masses one collide() call works on. Every array has one entry per
+// mass; the ones past the positions are the collide() scratch.
+class ColliderBatch {
+public:
+  void resize(unsigned count);
+  unsigned size() const;
+
+  // the position at the start of the step, used to catch tunnelling
+  void setStart(unsigned i, Vec3f const &position);
+  void set(unsigned i, Vec3f const &position, Vec3f const &velocity);
+
+  Vec3f position(unsigned i) const;
+  Vec3f velocity(unsigned i) const;
+  bool touched(unsigned i) const;   // inside an obstacle after the step
+
+private:
+  friend class ColliderSet;
+
+  std::vector<float> m_x, m_y, m_z;
+  std::vector<float> m_vx, m_vy, m_vz;
+  std::vector<float> m_sx, m_sy, m_sz;
+
+  // closest obstacle to every mass and the material it responds with
+  std::vector<float> m_phi, m_nx, m_ny, m_nz;
+  std::vector<float> m_restitution, m_slip, m_restSlip, m_restSpeed;
+  std::vector<float> m_startPhi, m_startNx, m_startNy, m_startNz;
+  std::vector<unsigned> m_swept;    // masses that may have passed through
+};
+
+class ColliderSet {
+public:
+  ColliderSet();
+
+  void clear();
+  bool empty() const;
+  unsigned size() const;
+
+  // the half-space dot(normal, p) < offset, normal of unit length
+  void addPlane(Vec3f const &normal, float offset,
+                ColliderMaterial const &material);
+  void addBox(Vec3f const &min, Vec3f const &max,
+              ColliderMaterial const &material);
+  void addSphere(Vec3f const &centre, float radius,
+                 ColliderMaterial const &material);
+  void addCapsule(Vec3f const &a, Vec3f const &b, float radius,
+                  ColliderMaterial const &material);
+  void addVoxels(VoxelSdf const &sdf, ColliderMaterial const &material);
+
+  // Moves every mass of the batch that ended its step inside an obstacle
+  // back onto the surface of the closest one and answers on its velocity.
+  // A mass whose step could have crossed an obstacle without ending inside
+  // is marched along the step, which only the fastest ones need.
+  void collide(ColliderBatch &batch) const;
+
+  // how close a sweep has to get to an obstacle to count as touching it
+  void setSweepTolerance(float tolerance);
+
+private:
+  enum Shape { PLANE, BOX, SPHERE, CAPSULE, VOXELS };
+
+  struct Collider {
+    Shape shape;
+    Vec3f a, b;       // normal, centre, or capsule ends; half extents
+    float radius;     // plane offset, sphere and capsule radius
+    unsigned voxels;  // into m_voxels
+    ColliderMaterial material;
+  };
+
+  // Writes the closest obstacle of the masses [begin, end) of the batch
+  // into its scratch, at the positions x, y, z.
+  void closest(ColliderBatch &batch, unsigned begin, unsigned end,
+               float const *x, float const *y, float const *z) const;
+  void sweep(ColliderBatch &batch, unsigned i) const;
+
+  std::vector<Collider> m_colliders;
+  std::vector<VoxelSdf> m_voxels;
+  float m_sweepTolerance;
+};
+
+// INLINE DEFINITIONS //
+
+inline bool VoxelSdf::empty() const { return m_values.empty(); }
+
+inline Vec3f const &VoxelSdf::origin() const { return m_origin; }
+
+inline float VoxelSdf::cellSize() const { return m_cellSize; }
+
+inline unsigned VoxelSdf::nodes(int axis) const { return m_nodes[axis]; }
+
+inline float VoxelSdf::value(unsigned x, unsigned y, unsigned z) const {
+  return m_values[(z * m_nodes[1] + y) * m_nodes[0] + x];
+}
+
+inline float const *VoxelSdf::values() const { return &m_values[0]; }
+
+inline unsigned ColliderBatch::size() const { return m_x.size(); }
+
+inline void ColliderBatch::setStart(unsigned i, Vec3f const &position) {
+  m_sx[i] = position.x();
+  m_sy[i] = position.y();
+  m_sz[i] = position.z();
+}
+
+inline void ColliderBatch::set(unsigned i, Vec3f const &position,
+                               Vec3f const &velocity) {
+  m_x[i] = position.x();
+  m_y[i] = position.y();
+  m_z[i] = position.z();
+  m_vx[i] = velocity.x();
+  m_vy[i] = velocity.y();
+  m_vz[i] = velocity.z();
+}
+
+inline Vec3f ColliderBatch::position(unsigned i) const {
+  return Vec3f(m_x[i], m_y[i], m_z[i]);
+}
+
+inline Vec3f ColliderBatch::velocity(unsigned i) const {
+  return Vec3f(m_vx[i], m_vy[i], m_vz[i]);
+}
+
+inline bool ColliderBatch::touched(unsigned i) const {
+  return m_phi[i] <= 0;
+}
+
+inline bool ColliderSet::empty() const { return m_colliders.empty(); }
+
+inline unsigned ColliderSet::size() const { return m_colliders.size(); }
+
+inline void ColliderSet::setSweepTolerance(float tolerance) {
+  m_sweepTolerance = tolerance;
+}
+
+#endif // COLLIDER_H
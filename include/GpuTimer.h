@@ -0,0 +1,44 @@
+/**
+ * File:	GpuTimer.h
+ *
+ * Summary:
+ *
+ * Times a stretch of GL commands on the GPU with GL_TIME_ELAPSED queries.
+ * The results arrive frames after the commands are issued, so a few queries
+ * are kept in flight and read only once they are available; a frame that
+ * finds every query still busy goes untimed rather than waiting.
+ */
+
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include "glad/glad.h"
+
+class GpuTimer {
+public:
+  GpuTimer();
+
+  void create();
+  void destroy();
+
+  void begin();
+  void end();
+
+  // Mean milliseconds of the stretches finished since the last call, or -1
+  // if none have.
+  double average();
+
+private:
+  static const unsigned QUERIES = 4;
+
+  void collect();
+
+  GLuint m_queries[QUERIES];
+  bool m_pending[QUERIES];
+  unsigned m_next;
+  bool m_timing;
+  GLuint64 m_total;     // nanoseconds
+  unsigned m_count;
+};
+
+#endif // GPU_TIMER_H
@@ -0,0 +1,62 @@
+/**
+ * File:	HeadlessContext.h
+ *
+ * Summary:
+ *
+ * An OpenGL context for machines without a display. The context comes from
+ * EGL, on Mesa's surfaceless platform where there is one (llvmpipe needs no
+ * GPU) and the default display otherwise, with a one pixel pbuffer to be
+ * current on. Frames are drawn into a framebuffer object of any size,
+ * multisampled if asked, and read back from it once resolved.
+ */
+
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+#include "glad/glad.h"
+
+#include <EGL/egl.h>
+
+#include <vector>
+
+class HeadlessContext {
+public:
+  HeadlessContext();
+
+  // A 3.2 core context, made current. Returns false, with the reason
+  // printed, if there is none to be had.
+  bool create();
+  void destroy();
+
+  // for gladLoadGLLoader, once the context is current
+  static void *procAddress(char const *name);
+
+  // The framebuffer frames are drawn into, with samples per pixel (0 or 1
+  // for none). Needs the GL functions loaded.
+  bool createFramebuffer(int width, int height, int samples);
+  void bindFramebuffer();
+
+  // The frame drawn since bindFramebuffer(), as rows of RGB from the top.
+  void readFrame(std::vector<unsigned char> &pixels);
+
+  int width() const;
+  int height() const;
+
+private:
+  EGLDisplay m_display;
+  EGLSurface m_surface;
+  EGLContext m_context;
+
+  int m_width, m_height;
+  GLuint m_framebuffer;     // drawn into
+  GLuint m_resolve;         // read from, when m_framebuffer is multisampled
+  GLuint m_renderbuffers[3];
+};
+
+// INLINE DEFINITIONS //
+
+inline int HeadlessContext::width() const { return m_width; }
+
+inline int HeadlessContext::height() const { return m_height; }
+
+#endif // HEADLESS_CONTEXT_H
@@ -0,0 +1,68 @@
+/**
+ * File:	ImexSolver.h
+ *
+ * Summary:
+ *
+ * Linearised backward Euler solve for the stiff springs of an IMEX step.
+ * The caller adds every unknown mass with its right hand side
+ *
+ *   h * (f(x, v) + h * K * v)
+ *
+ * and every stiff spring with the PSD block S = alpha * I + beta * u * u^T
+ * (h^2 times its stiffness matrix plus h times its damping, negated), and
+ * solve() runs Jacobi preconditioned conjugate gradients on
+ *
+ *   (M + sum of S) * dv = rhs
+ *
+ * Spring endpoints that aren't unknowns (fixed or sleeping masses) are passed
+ * as -1 and hold still.
+ */
+
+#ifndef IMEX_SOLVER_H
+#define IMEX_SOLVER_H
+
+#include <vector>
+
+#include "Vec3f.h"
+
+class ImexSolver {
+public:
+  // forget the previous system and make room for n unknowns
+  void clear(unsigned n);
+
+  void setUnknown(unsigned i, float mass, Vec3f const &rhs);
+  void addRhs(unsigned i, Vec3f const &rhs);
+  void addSpring(int a, int b, Vec3f const &u, float alpha, float beta);
+
+  // returns the number of iterations taken
+  unsigned solve(unsigned maxIterations, float tolerance);
+
+  Vec3f const &deltaV(unsigned i) const;
+
+private:
+  struct Block {
+    int a, b;
+    Vec3f u;
+    float alpha, beta;
+  };
+
+  void multiply(std::vector<Vec3f> const &in, std::vector<Vec3f> &out) const;
+
+  std::vector<float> m_mass;
+  std::vector<Vec3f> m_rhs;
+  std::vector<Block> m_blocks;
+
+  // scratch, kept between solves so stepping doesn't allocate
+  std::vector<Vec3f> m_dv;
+  std::vector<Vec3f> m_r;
+  std::vector<Vec3f> m_z;
+  std::vector<Vec3f> m_p;
+  std::vector<Vec3f> m_Ap;
+  std::vector<Vec3f> m_invDiagonal;
+};
+
+// INLINE DEFINITIONS //
+
+inline Vec3f const &ImexSolver::deltaV(unsigned i) const { return m_dv[i]; }
+
+#endif // IMEX_SOLVER_H
@@ -0,0 +1,75 @@
+/**
+ * File:	MassPicker.h
+ *
+ * Summary:
+ *
+ * Finds the mass under the cursor. The masses are spheres and the springs
+ * capsules, all of one radius, and all of them are leaves of one Bvh.
+ * pick() casts the ray through the hierarchy nearest box first, and skips
+ * every subtree that starts past the closest hit so far. A pick visits a
+ * few dozen nodes, where a scan would test every mass and spring. A spring
+ * that is hit picks the end closer to the hit.
+ *
+ * build() sets up the hierarchy for a new set of masses and springs.
+ * refit() moves it with the masses, and rebuilds it once the refit has
+ * loosened it too far. Both go over every mass and spring, so they belong
+ * off the thread that picks. The boxes of the masses are centred on them,
+ * so pick() tests the positions they were fitted to without a copy.
+ */
+
+#ifndef MASS_PICKER_H
+#define MASS_PICKER_H
+
+#include <vector>
+
+#include "Vec3f.h"
+#include "Bvh.h"
+#include "ThreadPool.h"
+
+class MassPicker {
+public:
+  MassPicker();
+
+  void setRadius(float radius);
+  void clear();
+  bool empty() const;
+
+  // springs as pairs of indices into positions
+  void build(std::vector<Vec3f> const &positions,
+             std::vector<unsigned> const &springs, ThreadPool &pool);
+  void refit(std::vector<Vec3f> const &positions, ThreadPool &pool);
+
+  // The mass the ray from origin along the unit direction hits first, and
+  // how far along the ray; -1 if it hits none.
+  int pick(Vec3f const &origin, Vec3f const &direction,
+           float &distance) const;
+
+private:
+  void fitBoxes(std::vector<Vec3f> const &positions, ThreadPool &pool);
+  float hitSphere(Vec3f const &origin, Vec3f const &direction,
+                  unsigned mass) const;
+  float hitCapsule(Vec3f const &origin, Vec3f const &direction,
+                   unsigned spring, float &along) const;
+
+  Vec3f position(unsigned mass) const;
+
+  float m_radius;
+  float m_rebuildQuality;
+  unsigned m_masses;
+  std::vector<unsigned> m_springs;
+  std::vector<Aabb> m_boxes;      // masses, then springs
+  Bvh m_bvh;
+};
+
+// INLINE DEFINITIONS //
+
+inline void MassPicker::setRadius(float radius) { m_radius = radius; }
+
+inline bool MassPicker::empty() const { return m_bvh.empty(); }
+
+inline Vec3f MassPicker::position(unsigned mass) const {
+  Aabb const &box = m_boxes[mass];
+  return 0.5f * (box.min + box.max);
+}
+
+#endif // MASS_PICKER_H
@@ -0,0 +1,76 @@
+/**
+ * File:	NeighbourList.h
+ *
+ * Summary:
+ *
+ * Verlet neighbour lists: for every point, the points within radius + skin
+ * of it (per axis, matching the box test of mass contacts), stored in CSR
+ * form and sorted by index. As long as no point has moved more than half the
+ * skin since the build, every pair that comes within the radius is in the
+ * lists, so they can be reused over many substeps.
+ */
+
+#ifndef NEIGHBOUR_LIST_H
+#define NEIGHBOUR_LIST_H
+
+#include <vector>
+
+#include "Vec3f.h"
+#include "SpatialHashGrid.h"
+#include "ThreadPool.h"
+
+class NeighbourList {
+public:
+  NeighbourList();
+
+  void setRange(float radius, float skin);
+
+  // True once a point, moved on by up to margin more, could have gone half
+  // the skin from where it was at the last build, or the count changed.
+  bool stale(std::vector<Vec3f> const &positions, float margin) const;
+
+  void build(std::vector<Vec3f> const &positions, ThreadPool &pool);
+
+  // the neighbours of point i, in increasing order
+  unsigned const *begin(unsigned i) const;
+  unsigned const *end(unsigned i) const;
+
+  unsigned pairCount() const;
+  unsigned buildCount() const;
+
+private:
+  bool withinRange(Vec3f const &a, Vec3f const &b) const;
+
+  float m_radius;
+  float m_skin;
+  unsigned m_builds;
+
+  SpatialHashGrid m_grid;
+  std::vector<Vec3f> m_reference;       // positions at the last build
+  std::vector<unsigned> m_offsets;      // count + 1
+  std::vector<unsigned> m_neighbours;
+
+  std::vector<std::vector<unsigned> > m_candidates;  // per pool thread
+};
+
+// INLINE DEFINITIONS //
+
+inline unsigned const *NeighbourList::begin(unsigned i) const {
+  return m_neighbours.data() + m_offsets[i];
+}
+
+inline unsigned const *NeighbourList::end(unsigned i) const {
+  return m_neighbours.data() + m_offsets[i + 1];
+}
+
+inline unsigned NeighbourList::pairCount() const { return m_neighbours.size(); }
+
+inline unsigned NeighbourList::buildCount() const { return m_builds; }
+
+inline bool NeighbourList::withinRange(Vec3f const &a, Vec3f const &b) const {
+  Vec3f diff = abs(a - b);
+  float range = m_radius + m_skin;
+  return diff.x() < range && diff.y() < range && diff.z() < range;
+}
+
+#endif // NEIGHBOUR_LIST_H
@@ -0,0 +1,83 @@
+/**
+ * File:	ShaderProgram.h
+ *
+ * Summary:
+ *
+ * A linked shader program with the locations of its per-object uniforms
+ * looked up once, at link time, and the values last given to them kept, so
+ * setting a uniform to the value it already has, or using the program that
+ * is already in use, makes no GL call. The per-frame data, the camera among
+ * it, is not a uniform of any one program but the Frame block, bound to
+ * FRAME_BINDING in every program that declares it and filled once a frame
+ * from one buffer.
+ *
+ * A Material is the program and the per-object values an object is drawn
+ * with.
+ */
+
+#ifndef SHADER_PROGRAM_H
+#define SHADER_PROGRAM_H
+
+#include "glad/glad.h"
+
+#include <string>
+
+class ShaderProgram {
+public:
+  enum Uniform { COLOR, SCALE, UNIFORM_COUNT };
+
+  // the uniform buffer binding the Frame block reads from
+  static const GLuint FRAME_BINDING = 0;
+
+  ShaderProgram();
+
+  // Returns false, with the errors printed, if the program doesn't link.
+  bool create(std::string const &vsSource, std::string const &fsSource);
+  bool create(std::string const &vsSource, std::string const &gsSource,
+              std::string const &fsSource);
+  void destroy();
+
+  GLuint id() const;
+  void use();
+
+  // skipped if the program doesn't have the uniform
+  void set(Uniform uniform, float x);
+  void set(Uniform uniform, float x, float y, float z);
+
+private:
+  bool link(GLuint id);
+
+  static GLuint s_current;  // in use
+
+  GLuint m_id;
+  GLint m_locations[UNIFORM_COUNT];
+  float m_values[UNIFORM_COUNT][3];
+  bool m_set[UNIFORM_COUNT];
+};
+
+class Material {
+public:
+  Material();
+  Material(ShaderProgram *program, float r, float g, float b, float scale);
+
+  // uses the program with this material's values
+  void apply() const;
+
+private:
+  ShaderProgram *m_program;
+  float m_color[3];
+  float m_scale;
+};
+
+// INLINE DEFINITIONS //
+
+inline GLuint ShaderProgram::id() const { return m_id; }
+
+inline void ShaderProgram::use() {
+  if (s_current == m_id)
+    return;
+  glUseProgram(m_id);
+  s_current = m_id;
+}
+
+#endif // SHADER_PROGRAM_H
@@ -0,0 +1,68 @@
+/**
+ * File:	SpatialHashGrid.h
+ *
+ * Summary:
+ *
+ * Uniform grid over an unbounded space, hashed into a table of buckets. The
+ * points are binned with a counting sort into one flat array, so a bucket is
+ * a contiguous range of point indices. With a cell size at least as big as
+ * the query radius, everything within the radius of a point is in one of the
+ * 27 cells around it.
+ */
+
+#ifndef SPATIAL_HASH_GRID_H
+#define SPATIAL_HASH_GRID_H
+
+#include <vector>
+
+#include "Vec3f.h"
+#include "ThreadPool.h"
+
+class SpatialHashGrid {
+public:
+  SpatialHashGrid();
+
+  void setCellSize(float size);
+  float cellSize() const;
+
+  // Rebins all positions; indices returned by the queries are into this
+  // array. The counting sort is split across the pool's threads.
+  void build(std::vector<Vec3f> const &positions, ThreadPool &pool);
+
+  // Appends to out the indices of the points binned in the 27 cells around p.
+  // Candidates only, the caller does the exact distance test.
+  void gatherNeighbours(Vec3f const &p, std::vector<unsigned> &out) const;
+
+  unsigned bucketCount() const;
+
+private:
+  unsigned bucketOf(int x, int y, int z) const;
+  int cellCoordinate(float f) const;
+
+  float m_cellSize;
+  float m_invCellSize;
+  unsigned m_mask;            // bucket count - 1, a power of two
+
+  std::vector<unsigned> m_bucketStart;  // bucketCount + 1 offsets
+  std::vector<unsigned> m_sorted;       // point indices, grouped by bucket
+
+  // counting sort scratch
+  std::vector<unsigned> m_bucketOfPoint;
+  std::vector<unsigned> m_chunkCounts;  // chunk major, chunks * buckets
+};
+
+// INLINE DEFINITIONS //
+
+inline float SpatialHashGrid::cellSize() const { return m_cellSize; }
+
+inline unsigned SpatialHashGrid::bucketCount() const { return m_mask + 1; }
+
+inline int SpatialHashGrid::cellCoordinate(float f) const {
+  return static_cast<int>(std::floor(f * m_invCellSize));
+}
+
+inline unsigned SpatialHashGrid::bucketOf(int x, int y, int z) const {
+  return ((x * 73856093u) ^ (y * 19349663u) ^ (z * 83492791u)) & m_mask;
+}
+
+#endif // SPATIAL_HASH_GRID_H
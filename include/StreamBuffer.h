@@ -0,0 +1,87 @@
+/**
+ * File:	StreamBuffer.h
+ *
+ * Summary:
+ *
+ * A vertex buffer that is written again every frame. Where the driver has
+ * ARB_buffer_storage, the buffer is three regions of one persistently mapped
+ * allocation, used in turn, and the vertices are written straight into the
+ * region the GPU finished with two frames ago. A fence set after the draws
+ * that read a region is waited on before that region is written again, which
+ * only blocks if the GPU falls three frames behind.
+ *
+ * Without buffer storage the vertices go into a staging array kept between
+ * frames, and unmap() orphans the buffer and uploads them with
+ * glBufferSubData, so the driver hands out fresh storage instead of waiting
+ * for draws still reading the old.
+ *
+ * Either way map() gives the memory to write the frame's vertices into,
+ * unmap() finishes them, and first() is where they start, in vertices, for
+ * glDrawArrays.
+ */
+
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include "glad/glad.h"
+
+#include <cstddef>
+#include <vector>
+
+class StreamBuffer {
+public:
+  // stride is the size of one vertex, in bytes
+  explicit StreamBuffer(unsigned stride);
+
+  // A new vertex size takes effect with the next reserve(), which then
+  // starts over.
+  void setStride(unsigned stride);
+  unsigned stride() const;
+
+  // Looks up glBufferStorage with load, once there is a context. Returns
+  // false, and every StreamBuffer orphans instead, if it isn't there.
+  static bool loadPersistentMapping(GLADloadproc load);
+  static bool persistent();
+
+  void create();
+  void destroy();
+  GLuint id() const;
+
+  // Makes room for the given number of vertices. Returns true if that
+  // meant a new buffer, which vertex arrays have to be pointed at again.
+  bool reserve(unsigned vertices);
+
+  // room for the vertices of this frame, up to the ones reserved
+  void *map();
+  void unmap(unsigned vertices);
+
+  // after the draws that read the vertices of this frame
+  void fence();
+
+  unsigned first() const;
+
+private:
+  static const unsigned REGIONS = 3;
+
+  void waitRegion(unsigned region);
+
+  unsigned m_stride;
+  GLuint m_id;
+  unsigned m_capacity;     // vertices per region
+  unsigned m_region;       // written last
+  char *m_mapped;          // all regions, when persistent
+  GLsync m_fences[REGIONS];
+  std::vector<char> m_staging;
+};
+
+// INLINE DEFINITIONS //
+
+inline GLuint StreamBuffer::id() const { return m_id; }
+
+inline unsigned StreamBuffer::stride() const { return m_stride; }
+
+inline unsigned StreamBuffer::first() const {
+  return m_mapped ? m_region * m_capacity : 0;
+}
+
+#endif // STREAM_BUFFER_H
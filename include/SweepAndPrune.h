@@ -0,0 +1,84 @@
+/**
+ * File:	SweepAndPrune.h
+ *
+ * Summary:
+ *
+ * Broadphase over a set of boxes that move a little between updates. The
+ * ends of the boxes are kept sorted along each axis, and update() sorts them
+ * again with an insertion sort, which is close to linear when little has
+ * moved. Every swap the sort makes is a box end passing another box's end,
+ * the only moments two boxes can start or stop overlapping, so the set of
+ * overlapping pairs is kept up to date from the swaps instead of being
+ * searched for again: an update costs O(n + swaps + pairs).
+ */
+
+#ifndef SWEEP_AND_PRUNE_H
+#define SWEEP_AND_PRUNE_H
+
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "Bvh.h"
+
+class SweepAndPrune {
+public:
+  struct Pair {
+    unsigned a, b;  // a < b
+  };
+
+  SweepAndPrune();
+
+  void clear();
+
+  // Moves the boxes to their new places. A different number of boxes than
+  // last time starts over with a full sort.
+  void update(std::vector<Aabb> const &boxes);
+
+  // overlapping pairs after the last update, in order
+  std::vector<Pair> const &pairs() const;
+
+  unsigned boxCount() const;
+  unsigned swapCount() const;   // made by the last update
+
+private:
+  struct Endpoint {
+    float value;
+    unsigned box;
+    bool max;
+  };
+
+  void rebuild();
+  void sortAxis(int axis);
+  bool overlap(unsigned a, unsigned b) const;
+
+  static unsigned long long key(unsigned a, unsigned b);
+
+  std::vector<Aabb> m_boxes;
+  std::vector<Endpoint> m_endpoints[3];
+  std::unordered_set<unsigned long long> m_overlaps;
+  std::vector<Pair> m_pairs;
+  unsigned m_swaps;
+};
+
+// INLINE DEFINITIONS //
+
+inline std::vector<SweepAndPrune::Pair> const &SweepAndPrune::pairs() const {
+  return m_pairs;
+}
+
+inline unsigned SweepAndPrune::boxCount() const { return m_boxes.size(); }
+
+inline unsigned SweepAndPrune::swapCount() const { return m_swaps; }
+
+inline bool SweepAndPrune::overlap(unsigned a, unsigned b) const {
+  return m_boxes[a].overlaps(m_boxes[b]);
+}
+
+inline unsigned long long SweepAndPrune::key(unsigned a, unsigned b) {
+  if (a > b)
+    std::swap(a, b);
+  return (static_cast<unsigned long long>(a) << 32) | b;
+}
+
+#endif // SWEEP_AND_PRUNE_H
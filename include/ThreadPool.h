@@ -0,0 +1,56 @@
+/**
+ * File:	ThreadPool.h
+ *
+ * Summary:
+ *
+ * A fixed set of worker threads for the data parallel passes of the
+ * simulation. parallelFor hands out indices from a shared counter, so work
+ * items of uneven size (islands of different sizes, say) balance themselves.
+ * A parallelFor issued from inside a task runs serially on that thread.
+ * Only one thread at a time may issue them; threads that run side by side
+ * each have a pool of their own.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+  // 0 uses one thread per hardware thread (the caller counts as one)
+  explicit ThreadPool(unsigned threadCount = 0);
+  ~ThreadPool();
+
+  ThreadPool(ThreadPool const &) = delete;
+  ThreadPool &operator=(ThreadPool const &) = delete;
+
+  // Runs task(i) for every i in [0, count) and returns once all are done.
+  void parallelFor(unsigned count, std::function<void(unsigned)> const &task);
+
+  // Number of threads that take part in a parallelFor, caller included.
+  unsigned size() const;
+
+private:
+  void workerLoop();
+  void runTasks();
+
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_done;
+
+  std::function<void(unsigned)> const *m_task;
+  unsigned m_count;
+  std::atomic<unsigned> m_next;
+  unsigned m_busy;
+  unsigned m_generation;
+  bool m_quit;
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,78 @@
+/**
+ * File:	TripleBuffer.h
+ *
+ * Summary:
+ *
+ * Hands whole values from one writing thread to one reading thread without
+ * either waiting on the other. Of three slots the writer fills the back one
+ * and publishes it by swapping it with the middle one; the reader, when
+ * there is something newer, swaps the middle one with the front one it
+ * reads. The swaps are single atomic exchanges, and the slot just published
+ * is marked fresh so the reader never takes an older value twice.
+ *
+ * Only one thread may be writing at a time, but which one can change if
+ * something else (a mutex) orders them.
+ */
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+template <class T> class TripleBuffer {
+public:
+  TripleBuffer();
+
+  TripleBuffer(TripleBuffer const &) = delete;
+  TripleBuffer &operator=(TripleBuffer const &) = delete;
+
+  // the writer's slot, and handing it over once it is complete
+  T &back();
+  void publish();
+
+  // whether there is a value published that the reader hasn't had yet
+  bool fresh() const;
+
+  // Takes the last value published, if the reader hasn't had it yet.
+  // Returns false, and front() stays as it was, otherwise.
+  bool acquire();
+  T const &front() const;
+
+private:
+  static const unsigned FRESH = 4;  // on the index of the middle slot
+
+  T m_slots[3];
+  unsigned m_back;
+  unsigned m_front;
+  std::atomic<unsigned> m_middle;
+};
+
+// INLINE DEFINITIONS //
+
+template <class T>
+TripleBuffer<T>::TripleBuffer() : m_back(0), m_front(1), m_middle(2) {}
+
+template <class T> T &TripleBuffer<T>::back() { return m_slots[m_back]; }
+
+template <class T> void TripleBuffer<T>::publish() {
+  m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) &
+           ~FRESH;
+}
+
+template <class T> bool TripleBuffer<T>::fresh() const {
+  return m_middle.load(std::memory_order_relaxed) & FRESH;
+}
+
+template <class T> bool TripleBuffer<T>::acquire() {
+  if (!fresh())
+    return false;
+
+  m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & ~FRESH;
+  return true;
+}
+
+template <class T> T const &TripleBuffer<T>::front() const {
+  return m_slots[m_front];
+}
+
+#endif // TRIPLE_BUFFER_H
@@ -0,0 +1,55 @@
+/**
+ * File:	UnionFind.h
+ *
+ * Summary:
+ *
+ * Disjoint sets over the indices [0, n) with path halving and union by
+ * size. Used to split the spring network into connected islands.
+ */
+
+#ifndef UNION_FIND_H
+#define UNION_FIND_H
+
+#include <utility>
+#include <vector>
+
+class UnionFind {
+public:
+  explicit UnionFind(unsigned n = 0);
+
+  unsigned find(unsigned i);
+  void unite(unsigned a, unsigned b);
+
+private:
+  std::vector<unsigned> m_parent;
+  std::vector<unsigned> m_size;
+};
+
+// INLINE DEFINITIONS //
+
+inline UnionFind::UnionFind(unsigned n) : m_parent(n), m_size(n, 1) {
+  for (unsigned i = 0; i < n; i++)
+    m_parent[i] = i;
+}
+
+inline unsigned UnionFind::find(unsigned i) {
+  while (m_parent[i] != i) {
+    m_parent[i] = m_parent[m_parent[i]];
+    i = m_parent[i];
+  }
+  return i;
+}
+
+inline void UnionFind::unite(unsigned a, unsigned b) {
+  a = find(a);
+  b = find(b);
+  if (a == b)
+    return;
+
+  if (m_size[a] < m_size[b])
+    std::swap(a, b);
+  m_parent[b] = a;
+  m_size[a] += m_size[b];
+}
+
+#endif // UNION_FIND_H
@@ -1,13 +1,32 @@
 #version 330
 layout( location = 0 ) in vec3 vert_modelSpace;
+// The mass position: per instance for the quads, per vertex for the springs,
+// whose vert_modelSpace is left disabled (0).
+layout( location = 1 ) in vec3 mass_modelSpace;
+
+// filled once a frame, from the same buffer for every program
+layout( std140, row_major ) uniform Frame
+{
+	mat4 V;
+	mat4 P;
+	mat4 VP;
+	vec4 cameraRight;   // in world space
+	vec4 cameraUp;
+	vec4 cameraForward;
+	vec4 positionOrigin;  // mass positions are origin + scale * attribute
+	vec4 positionScale;
+	ivec4 lattice;  // cloth length and width, and where its positions start
+};
 
-uniform mat4 MVP;
 uniform vec3 inputColor;
+uniform float scale;
 
 out vec3 interpolateColor;
 
 void main()
 {
-	gl_Position = MVP * vec4( vert_modelSpace, 1.0 );
+	vec3 mass = positionOrigin.xyz + positionScale.xyz * mass_modelSpace;
+	vec3 position = vert_modelSpace * scale + mass;
+	gl_Position = VP * vec4( position, 1.0 );
 	interpolateColor = inputColor;
 }
@@ -0,0 +1,42 @@
+#version 330
+// Grows every mass into a square of side scale facing the camera, from the
+// camera's right and up directions in model space.
+layout( points ) in;
+layout( triangle_strip, max_vertices = 4 ) out;
+
+// filled once a frame, from the same buffer for every program
+layout( std140, row_major ) uniform Frame
+{
+	mat4 V;
+	mat4 P;
+	mat4 VP;
+	vec4 cameraRight;   // in world space
+	vec4 cameraUp;
+	vec4 cameraForward;
+	vec4 positionOrigin;  // mass positions are origin + scale * attribute
+	vec4 positionScale;
+	ivec4 lattice;  // cloth length and width, and where its positions start
+};
+
+uniform vec3 inputColor;
+uniform float scale;
+
+out vec3 interpolateColor;
+
+void main()
+{
+	vec3 centre = gl_in[0].gl_Position.xyz;
+	vec3 right = 0.5 * scale * cameraRight.xyz;
+	vec3 up = 0.5 * scale * cameraUp.xyz;
+
+	interpolateColor = inputColor;
+	gl_Position = VP * vec4( centre - right - up, 1.0 );
+	EmitVertex();
+	gl_Position = VP * vec4( centre + right - up, 1.0 );
+	EmitVertex();
+	gl_Position = VP * vec4( centre - right + up, 1.0 );
+	EmitVertex();
+	gl_Position = VP * vec4( centre + right + up, 1.0 );
+	EmitVertex();
+	EndPrimitive();
+}
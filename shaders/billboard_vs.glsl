@@ -0,0 +1,22 @@
+#version 330
+layout( location = 0 ) in vec3 vert_modelSpace;
+
+// filled once a frame, from the same buffer for every program
+layout( std140, row_major ) uniform Frame
+{
+	mat4 V;
+	mat4 P;
+	mat4 VP;
+	vec4 cameraRight;   // in world space
+	vec4 cameraUp;
+	vec4 cameraForward;
+	vec4 positionOrigin;  // mass positions are origin + scale * attribute
+	vec4 positionScale;
+	ivec4 lattice;  // cloth length and width, and where its positions start
+};
+
+void main()
+{
+	vec3 mass = positionOrigin.xyz + positionScale.xyz * vert_modelSpace;
+	gl_Position = vec4( mass, 1.0 );
+}
@@ -0,0 +1,56 @@
+#version 330
+// The lattice positions, read from the mass buffer one coordinate a texel so
+// the neighbours of each vertex can be too. gl_VertexID is the vertex's
+// place in the lattice.
+uniform samplerBuffer positions;
+
+// filled once a frame, from the same buffer for every program
+layout( std140, row_major ) uniform Frame
+{
+	mat4 V;
+	mat4 P;
+	mat4 VP;
+	vec4 cameraRight;   // in world space
+	vec4 cameraUp;
+	vec4 cameraForward;
+	vec4 positionOrigin;  // mass positions are origin + scale * attribute
+	vec4 positionScale;
+	ivec4 lattice;  // cloth length and width, and where its positions start
+};
+
+uniform vec3 inputColor;
+
+out vec3 interpolateColor;
+
+vec3 latticePosition( int row, int column )
+{
+	int texel = 3 * ( lattice.z + row * lattice.x + column );
+	vec3 stored = vec3( texelFetch( positions, texel ).r,
+	                    texelFetch( positions, texel + 1 ).r,
+	                    texelFetch( positions, texel + 2 ).r );
+	return positionOrigin.xyz + positionScale.xyz * stored;
+}
+
+void main()
+{
+	int row = gl_VertexID / lattice.x;
+	int column = gl_VertexID - row * lattice.x;
+	vec3 mass = latticePosition( row, column );
+	gl_Position = VP * vec4( mass, 1.0 );
+
+	// the normal from the central differences across the lattice, one sided
+	// at its border
+	int left = max( column - 1, 0 );
+	int right = min( column + 1, lattice.x - 1 );
+	int down = max( row - 1, 0 );
+	int up = min( row + 1, lattice.y - 1 );
+	vec3 across = latticePosition( row, right ) - latticePosition( row, left );
+	vec3 along = latticePosition( up, column ) - latticePosition( down, column );
+	vec3 normal = cross( across, along );
+
+	// lit from the camera, on both sides as the normals can face either way
+	float size = length( normal );
+	float diffuse = size > 0.0 ? abs( dot( normal, cameraForward.xyz ) ) / size
+	                           : 0.0;
+	interpolateColor = inputColor * ( 0.25 + 0.75 * diffuse );
+}
@@ -0,0 +1,319 @@
+/**
+ * File:	Bvh.cpp
+ */
+
+#include "Bvh.h"
+
+#include <algorithm>
+
+namespace {
+
+unsigned const mortonBits = 10;  // per axis, 30 in all
+unsigned const radixBits = 8;
+unsigned const radixSize = 1 << radixBits;
+unsigned const areaChunkSize = 4096;
+
+// spreads the low 10 bits of v out to every third bit
+std::uint32_t spreadBits(std::uint32_t v) {
+  v &= 0x3ff;
+  v = (v | v << 16) & 0x30000ff;
+  v = (v | v << 8) & 0x300f00f;
+  v = (v | v << 4) & 0x30c30c3;
+  v = (v | v << 2) & 0x9249249;
+  return v;
+}
+
+unsigned quantize(float x, float low, float scale) {
+  float q = (x - low) * scale;
+  unsigned top = (1u << mortonBits) - 1;
+  if (!(q > 0))
+    return 0;
+  return q >= top ? top : unsigned(q);
+}
+
+} // namespace
+
+Bvh::Bvh() : m_visitCount(0), m_builtArea(0), m_area(0) {}
+
+unsigned Bvh::chunkCount(unsigned items, ThreadPool &pool) const {
+  return std::max(1u, std::min(4 * pool.size(), items / 1024));
+}
+
+void Bvh::build(std::vector<Aabb> const &boxes, ThreadPool &pool) {
+  if (!allocate(boxes.size()))
+    return;
+  computeCodes(boxes, pool);
+  link(boxes, pool);
+}
+
+void Bvh::build(std::vector<Aabb> const &boxes,
+                std::vector<std::uint32_t> const &codes, ThreadPool &pool) {
+  if (!allocate(boxes.size()))
+    return;
+  m_codes = codes;
+  m_sorted.resize(codes.size());
+  for (unsigned i = 0; i < codes.size(); i++)
+    m_sorted[i] = i;
+  link(boxes, pool);
+}
+
+// Sizes the nodes for count primitives, false when there are none.
+bool Bvh::allocate(unsigned count) {
+  m_leafOf.resize(count);
+  m_tasks.clear();
+  if (count == 0) {
+    m_nodes.clear();
+    m_area = m_builtArea = 0;
+    return false;
+  }
+
+  m_nodes.resize(2 * count - 1);
+  if (m_visitCount < m_nodes.size()) {
+    m_visits.reset(new std::atomic<int>[m_nodes.size()]);
+    m_visitCount = m_nodes.size();
+    for (unsigned i = 0; i < m_visitCount; i++)
+      m_visits[i].store(0, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+void Bvh::link(std::vector<Aabb> const &boxes, ThreadPool &pool) {
+  sortCodes(pool);
+  linkNodes(pool);
+  fitBoxes(boxes, pool);
+  m_builtArea = m_area;
+  buildTasks(root(), 0);
+}
+
+void Bvh::computeCodes(std::vector<Aabb> const &boxes, ThreadPool &pool) {
+  unsigned count = boxes.size();
+  unsigned chunks = chunkCount(count, pool);
+  unsigned chunkSize = (count + chunks - 1) / chunks;
+  m_chunkBounds.resize(chunks);
+  pool.parallelFor(chunks, [&](unsigned chunk) {
+    Aabb bounds = Aabb::empty();
+    unsigned end = std::min(count, (chunk + 1) * chunkSize);
+    for (unsigned i = chunk * chunkSize; i < end; i++)
+      bounds.grow(boxes[i].centroid());
+    m_chunkBounds[chunk] = bounds;
+  });
+
+  Aabb bounds = Aabb::empty();
+  for (unsigned chunk = 0; chunk < chunks; chunk++)
+    bounds.grow(m_chunkBounds[chunk]);
+
+  Vec3f extent = bounds.max - bounds.min;
+  float scale[3];
+  for (int axis = 0; axis < 3; axis++)
+    scale[axis] = extent[axis] > 0 ? (1u << mortonBits) / extent[axis] : 0;
+
+  m_codes.resize(count);
+  m_sorted.resize(count);
+  pool.parallelFor(chunks, [&](unsigned chunk) {
+    unsigned end = std::min(count, (chunk + 1) * chunkSize);
+    for (unsigned i = chunk * chunkSize; i < end; i++) {
+      Vec3f c = boxes[i].centroid();
+      m_codes[i] = spreadBits(quantize(c.x(), bounds.min.x(), scale[0])) |
+                   spreadBits(quantize(c.y(), bounds.min.y(), scale[1])) << 1 |
+                   spreadBits(quantize(c.z(), bounds.min.z(), scale[2])) << 2;
+      m_sorted[i] = i;
+    }
+  });
+}
+
+// Least significant digit radix sort of the codes, carrying the primitive
+// indices along. Every chunk counts its digits, a scan turns the counts into
+// the chunk's first slot for each digit, and the chunks scatter in parallel,
+// so the sort is stable and the same for any thread count. Digits that are
+// the same in every code are skipped.
+void Bvh::sortCodes(ThreadPool &pool) {
+  unsigned count = m_codes.size();
+  unsigned chunks = chunkCount(count, pool);
+  unsigned chunkSize = (count + chunks - 1) / chunks;
+  m_codesSwap.resize(count);
+  m_sortedSwap.resize(count);
+  m_digitCounts.resize(chunks * radixSize);
+
+  for (unsigned shift = 0; shift < 3 * mortonBits; shift += radixBits) {
+    pool.parallelFor(chunks, [&](unsigned chunk) {
+      unsigned *counts = &m_digitCounts[chunk * radixSize];
+      std::fill(counts, counts + radixSize, 0);
+      unsigned end = std::min(count, (chunk + 1) * chunkSize);
+      for (unsigned i = chunk * chunkSize; i < end; i++)
+        counts[(m_codes[i] >> shift) & (radixSize - 1)]++;
+    });
+
+    bool uniform = false;
+    unsigned next = 0;
+    for (unsigned digit = 0; digit < radixSize; digit++) {
+      unsigned total = 0;
+      for (unsigned chunk = 0; chunk < chunks; chunk++) {
+        unsigned &slot = m_digitCounts[chunk * radixSize + digit];
+        unsigned n = slot;
+        slot = next;
+        next += n;
+        total += n;
+      }
+      if (total == count)
+        uniform = true;
+    }
+    if (uniform)
+      continue;
+
+    pool.parallelFor(chunks, [&](unsigned chunk) {
+      unsigned *slots = &m_digitCounts[chunk * radixSize];
+      unsigned end = std::min(count, (chunk + 1) * chunkSize);
+      for (unsigned i = chunk * chunkSize; i < end; i++) {
+        unsigned slot = slots[(m_codes[i] >> shift) & (radixSize - 1)]++;
+        m_codesSwap[slot] = m_codes[i];
+        m_sortedSwap[slot] = m_sorted[i];
+      }
+    });
+    m_codes.swap(m_codesSwap);
+    m_sorted.swap(m_sortedSwap);
+  }
+}
+
+// Length of the common prefix of sorted codes i and j, -1 outside the
+// range. Equal codes are told apart by their positions.
+int Bvh::commonPrefix(int i, int j) const {
+  if (j < 0 || j >= int(m_codes.size()))
+    return -1;
+  std::uint32_t a = m_codes[i], b = m_codes[j];
+  if (a == b)
+    return 32 + __builtin_clz(unsigned(i ^ j));
+  return __builtin_clz(a ^ b);
+}
+
+void Bvh::linkNodes(ThreadPool &pool) {
+  int count = m_codes.size();
+  int firstLeaf = count - 1;
+  m_nodes[root()].parent = -1;
+
+  unsigned chunks = chunkCount(count, pool);
+  unsigned chunkSize = (count + chunks - 1) / chunks;
+  pool.parallelFor(chunks, [&](unsigned chunk) {
+    int begin = chunk * chunkSize;
+    int end = std::min<int>(count, (chunk + 1) * chunkSize);
+    for (int k = begin; k < end; k++) {
+      Node &leaf = m_nodes[firstLeaf + k];
+      leaf.left = leaf.right = -1;
+      leaf.primitive = m_sorted[k];
+      m_leafOf[leaf.primitive] = firstLeaf + k;
+    }
+
+    for (int i = begin; i < std::min(end, count - 1); i++) {
+      // the range of node i runs from i towards the neighbour it shares
+      // the longer prefix with
+      int d = commonPrefix(i, i + 1) > commonPrefix(i, i - 1) ? 1 : -1;
+      int minPrefix = commonPrefix(i, i - d);
+      int maxLength = 2;
+      while (commonPrefix(i, i + maxLength * d) > minPrefix)
+        maxLength *= 2;
+      int length = 0;
+      for (int step = maxLength / 2; step >= 1; step /= 2) {
+        if (commonPrefix(i, i + (length + step) * d) > minPrefix)
+          length += step;
+      }
+      int j = i + length * d;
+
+      // and splits where the prefix of the whole range ends
+      int nodePrefix = commonPrefix(i, j);
+      int split = 0;
+      int step = length;
+      do {
+        step = (step + 1) / 2;
+        if (commonPrefix(i, i + (split + step) * d) > nodePrefix)
+          split += step;
+      } while (step > 1);
+      int gamma = i + split * d + std::min(d, 0);
+
+      Node &n = m_nodes[i];
+      n.left = std::min(i, j) == gamma ? firstLeaf + gamma : gamma;
+      n.right = std::max(i, j) == gamma + 1 ? firstLeaf + gamma + 1 : gamma + 1;
+      n.primitive = -1;
+      m_nodes[n.left].parent = i;
+      m_nodes[n.right].parent = i;
+    }
+  });
+}
+
+void Bvh::refit(std::vector<Aabb> const &boxes, ThreadPool &pool) {
+  if (!m_nodes.empty())
+    fitBoxes(boxes, pool);
+}
+
+void Bvh::fitBoxes(std::vector<Aabb> const &boxes, ThreadPool &pool) {
+  unsigned count = m_leafOf.size();
+  unsigned firstLeaf = count - 1;
+
+  // every leaf walks up to the root; the first child to arrive at a node
+  // stops there, the second one has both boxes ready, resets the count for
+  // next time and carries on. Going through the leaves in Morton order keeps
+  // the parents of a chunk close together in memory.
+  unsigned chunks = chunkCount(count, pool);
+  unsigned chunkSize = (count + chunks - 1) / chunks;
+  pool.parallelFor(chunks, [&](unsigned chunk) {
+    unsigned end = std::min(count, (chunk + 1) * chunkSize);
+    for (unsigned k = chunk * chunkSize; k < end; k++) {
+      int index = firstLeaf + k;
+      m_nodes[index].box = boxes[m_nodes[index].primitive];
+
+      index = m_nodes[index].parent;
+      while (index >= 0) {
+        if (m_visits[index].fetch_add(1, std::memory_order_acq_rel) == 0)
+          break;
+        m_visits[index].store(0, std::memory_order_relaxed);
+
+        Node &n = m_nodes[index];
+        n.box = m_nodes[n.left].box;
+        n.box.grow(m_nodes[n.right].box);
+        index = n.parent;
+      }
+    }
+  });
+
+  m_area = internalArea(pool);
+}
+
+// The internal nodes are the first count - 1, summed in fixed size chunks so
+// the total doesn't depend on the thread count.
+float Bvh::internalArea(ThreadPool &pool) {
+  unsigned internal = m_leafOf.size() - 1;
+  unsigned chunks = (internal + areaChunkSize - 1) / areaChunkSize;
+  m_chunkAreas.resize(chunks);
+  pool.parallelFor(chunks, [&](unsigned chunk) {
+    float area = 0;
+    unsigned end = std::min(internal, (chunk + 1) * areaChunkSize);
+    for (unsigned i = chunk * areaChunkSize; i < end; i++)
+      area += m_nodes[i].box.surfaceArea();
+    m_chunkAreas[chunk] = area;
+  });
+
+  float area = 0;
+  for (unsigned chunk = 0; chunk < chunks; chunk++)
+    area += m_chunkAreas[chunk];
+  return area;
+}
+
+float Bvh::quality() const {
+  if (m_builtArea <= 0)
+    return 1;
+  return m_area / m_builtArea;
+}
+
+// The top levels of the self query, unrolled into independent tasks: the
+// subtrees six levels down on their own, and every pair of siblings above.
+void Bvh::buildTasks(int node, unsigned depth) {
+  Node const &n = m_nodes[node];
+  if (n.primitive >= 0 || depth == 6) {
+    Task self = {node, node};
+    m_tasks.push_back(self);
+    return;
+  }
+
+  Task across = {n.left, n.right};
+  m_tasks.push_back(across);
+  buildTasks(n.left, depth + 1);
+  buildTasks(n.right, depth + 1);
+}
@@ -0,0 +1,899 @@
+/**
+ * File:	ClothCollision.cpp
+ */
+
+#include "ClothCollision.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+float clamp01(float x) { return std::min(1.f, std::max(0.f, x)); }
+
+// Closest point to p on triangle abc as barycentrics (Ericson, Real-Time
+// Collision Detection 5.1.5).
+void closestOnTriangle(Vec3f const &p, Vec3f const &a, Vec3f const &b,
+                       Vec3f const &c, float bary[3]) {
+  Vec3f ab = b - a, ac = c - a, ap = p - a;
+  float d1 = ab * ap, d2 = ac * ap;
+  if (d1 <= 0 && d2 <= 0) {
+    bary[0] = 1; bary[1] = 0; bary[2] = 0;
+    return;
+  }
+
+  Vec3f bp = p - b;
+  float d3 = ab * bp, d4 = ac * bp;
+  if (d3 >= 0 && d4 <= d3) {
+    bary[0] = 0; bary[1] = 1; bary[2] = 0;
+    return;
+  }
+
+  float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+    float v = d1 / (d1 - d3);
+    bary[0] = 1 - v; bary[1] = v; bary[2] = 0;
+    return;
+  }
+
+  Vec3f cp = p - c;
+  float d5 = ab * cp, d6 = ac * cp;
+  if (d6 >= 0 && d5 <= d6) {
+    bary[0] = 0; bary[1] = 0; bary[2] = 1;
+    return;
+  }
+
+  float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+    float w = d2 / (d2 - d6);
+    bary[0] = 1 - w; bary[1] = 0; bary[2] = w;
+    return;
+  }
+
+  float va = d3 * d6 - d5 * d4;
+  if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) {
+    float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+    bary[0] = 0; bary[1] = 1 - w; bary[2] = w;
+    return;
+  }
+
+  float denom = 1 / (va + vb + vc);
+  bary[1] = vb * denom;
+  bary[2] = vc * denom;
+  bary[0] = 1 - bary[1] - bary[2];
+}
+
+// Parameters s, t of the closest points of segments p1q1 and p2q2 (Ericson
+// 5.1.9).
+void closestOnSegments(Vec3f const &p1, Vec3f const &q1, Vec3f const &p2,
+                       Vec3f const &q2, float &s, float &t) {
+  Vec3f d1 = q1 - p1, d2 = q2 - p2, r = p1 - p2;
+  float a = d1 * d1, e = d2 * d2, f = d2 * r;
+  float c = d1 * r, b = d1 * d2;
+  float denom = a * e - b * b;
+
+  if (a == 0 || e == 0) {
+    s = a == 0 ? 0 : clamp01(-c / a);
+    t = e == 0 ? 0 : clamp01(f / e);
+    return;
+  }
+
+  s = denom > 0 ? clamp01((b * f - c * e) / denom) : 0;
+  t = (b * s + f) / e;
+  if (t < 0) {
+    t = 0;
+    s = clamp01(-c / a);
+  } else if (t > 1) {
+    t = 1;
+    s = clamp01((b - c) / a);
+  }
+}
+
+// Box around the given vertices at both ends of a step.
+Aabb sweptBox(std::vector<Vec3f> const &start, std::vector<Vec3f> const &end,
+              unsigned const *vertices, unsigned count, float margin) {
+  Aabb box = Aabb::empty();
+  for (unsigned k = 0; k < count; k++) {
+    box.grow(start[vertices[k]]);
+    box.grow(end[vertices[k]]);
+  }
+  box.inflate(margin);
+  return box;
+}
+
+struct Vec3d {
+  double x, y, z;
+  Vec3d(Vec3f const &v) : x(v.x()), y(v.y()), z(v.z()) {}
+  Vec3d(double x, double y, double z) : x(x), y(y), z(z) {}
+  Vec3d operator+(Vec3d const &o) const {
+    return Vec3d(x + o.x, y + o.y, z + o.z);
+  }
+  double operator*(Vec3d const &o) const {
+    return x * o.x + y * o.y + z * o.z;
+  }
+  Vec3d operator^(Vec3d const &o) const {
+    return Vec3d(y * o.z - z * o.y, z * o.x - x * o.z, x * o.y - y * o.x);
+  }
+};
+
+double cubic(double const c[4], double t) {
+  return ((c[3] * t + c[2]) * t + c[1]) * t + c[0];
+}
+
+// Times in [0, 1], increasing, at which (e1 + t ve1) x (e2 + t ve2) is
+// perpendicular to p + t vp, i.e. the four points of a vertex-triangle or
+// edge-edge pair moving linearly are coplanar. The cubic is cut at its
+// turning points into monotonic pieces, and every piece that changes sign is
+// bisected. A pair that stays coplanar gives both ends.
+unsigned coplanarTimes(Vec3d e1, Vec3d e2, Vec3d p, Vec3d ve1, Vec3d ve2,
+                       Vec3d vp, double times[3]) {
+  Vec3d n0 = e1 ^ e2;
+  Vec3d n1 = (e1 ^ ve2) + (ve1 ^ e2);
+  Vec3d n2 = ve1 ^ ve2;
+  double c[4] = {n0 * p, n0 * vp + n1 * p, n1 * vp + n2 * p, n2 * vp};
+
+  double cuts[4] = {0, 1, 1, 1};
+  unsigned cutCount = 1;
+  double a = 3 * c[3], b = 2 * c[2];
+  double turning[2];
+  unsigned turningCount = 0;
+  if (a != 0) {
+    double discriminant = b * b - 4 * a * c[1];
+    if (discriminant > 0) {
+      double root = std::sqrt(discriminant);
+      turning[turningCount++] = (-b - root) / (2 * a);
+      turning[turningCount++] = (-b + root) / (2 * a);
+      if (turning[0] > turning[1])
+        std::swap(turning[0], turning[1]);
+    }
+  } else if (b != 0) {
+    turning[turningCount++] = -c[1] / b;
+  }
+  for (unsigned k = 0; k < turningCount; k++) {
+    if (turning[k] > 0 && turning[k] < 1)
+      cuts[cutCount++] = turning[k];
+  }
+  cuts[cutCount++] = 1;
+
+  unsigned count = 0;
+  for (unsigned k = 0; k + 1 < cutCount; k++) {
+    double low = cuts[k], high = cuts[k + 1];
+    double fLow = cubic(c, low), fHigh = cubic(c, high);
+    if (fLow == 0) {
+      times[count++] = low;
+      continue;
+    }
+    if (fHigh == 0 || (fLow < 0) == (fHigh < 0))
+      continue;
+
+    for (int i = 0; i < 30; i++) {
+      double middle = 0.5 * (low + high);
+      double fMiddle = cubic(c, middle);
+      if ((fMiddle < 0) == (fLow < 0)) {
+        low = middle;
+        fLow = fMiddle;
+      } else {
+        high = middle;
+      }
+    }
+    times[count++] = 0.5 * (low + high);
+  }
+  if (cubic(c, 1) == 0 && count < 3)
+    times[count++] = 1;
+  return count;
+}
+
+template <class Pair> bool keyLess(Pair const &x, Pair const &y) {
+  return x.key < y.key;
+}
+
+float const pi = 3.14159265f;
+float const maxConeAngle = 1.5f;  // a little under a right angle
+
+// spreads the low 14 bits of v out to every other bit
+std::uint32_t spreadBits(std::uint32_t v) {
+  v &= 0x3fff;
+  v = (v | v << 8) & 0x00ff00ff;
+  v = (v | v << 4) & 0x0f0f0f0f;
+  v = (v | v << 2) & 0x33333333;
+  v = (v | v << 1) & 0x55555555;
+  return v;
+}
+
+// Column and row interleaved, then the triangle of the quad, so the
+// triangles of every aligned square of quads are consecutive.
+std::uint32_t latticeCode(unsigned column, unsigned row, unsigned triangle) {
+  return (spreadBits(column) | spreadBits(row) << 1) << 1 | triangle;
+}
+
+float cross2(float ax, float ay, float bx, float by) {
+  return ax * by - ay * bx;
+}
+
+// The smallest cone holding both (Sederberg and Meyers 1988). Going round
+// is the only way a merge can get past pi.
+template <class Cone> Cone mergeCones(Cone const &a, Cone const &b) {
+  if (a.angle >= pi || b.angle >= pi) {
+    Cone all = {a.axis, pi};
+    return all;
+  }
+  float between = std::acos(std::min(1.f, std::max(-1.f, a.axis * b.axis)));
+  if (between + b.angle <= a.angle)
+    return a;
+  if (between + a.angle <= b.angle)
+    return b;
+
+  Cone merged = {a.axis, 0.5f * (between + a.angle + b.angle)};
+  float sine = std::sin(between);
+  if (merged.angle >= pi || sine < 1e-6f) {
+    merged.angle = std::max(merged.angle, pi);
+    return merged;
+  }
+  // a's axis turned towards b's
+  float turn = merged.angle - a.angle;
+  merged.axis =
+      (std::sin(between - turn) * a.axis + std::sin(turn) * b.axis) / sine;
+  return merged;
+}
+
+} // namespace
+
+ClothCollision::ClothCollision()
+    : m_vertexCount(0), m_length(0), m_thickness(0), m_impactTolerance(0),
+      m_skin(0), m_tolerance(0), m_reused(0), m_smoothTriangles(0) {}
+
+void ClothCollision::clear() {
+  m_triangles.clear();
+  m_edges.clear();
+  m_contacts.clear();
+  m_cache.clear();
+  m_contactPair.clear();
+  m_vertexCount = 0;
+  m_length = 0;
+  m_codes.clear();
+  m_patches.clear();
+  m_bvh = Bvh();
+}
+
+void ClothCollision::setLattice(unsigned length, unsigned width) {
+  clear();
+  m_vertexCount = length * width;
+  m_length = length;
+  for (unsigned row = 0; row + 1 < width; row++) {
+    for (unsigned column = 0; column + 1 < length; column++) {
+      unsigned i = row * length + column;
+      Triangle upper = {{i, i + 1, i + length}, {0, 0, 0}};
+      Triangle lower = {{i + 1, i + length + 1, i + length}, {0, 0, 0}};
+      m_triangles.push_back(upper);
+      m_triangles.push_back(lower);
+      m_codes.push_back(latticeCode(column, row, 0));
+      m_codes.push_back(latticeCode(column, row, 1));
+    }
+  }
+  buildEdges();
+}
+
+// Every triangle side once, owned by the first triangle that has it, so the
+// edge query can skip the copy seen through the other triangle.
+void ClothCollision::buildEdges() {
+  struct Side {
+    unsigned a, b, triangle, corner;
+    bool operator<(Side const &o) const {
+      if (a != o.a) return a < o.a;
+      if (b != o.b) return b < o.b;
+      return triangle < o.triangle;
+    }
+  };
+
+  std::vector<Side> sides;
+  sides.reserve(3 * m_triangles.size());
+  for (unsigned t = 0; t < m_triangles.size(); t++) {
+    for (unsigned k = 0; k < 3; k++) {
+      unsigned a = m_triangles[t].v[k];
+      unsigned b = m_triangles[t].v[(k + 1) % 3];
+      Side side = {std::min(a, b), std::max(a, b), t, k};
+      sides.push_back(side);
+    }
+  }
+  std::sort(sides.begin(), sides.end());
+
+  m_vertexOwner.assign(m_vertexCount, ~0u);
+  for (unsigned t = m_triangles.size(); t-- > 0;) {
+    for (unsigned k = 0; k < 3; k++)
+      m_vertexOwner[m_triangles[t].v[k]] = t;
+  }
+
+  for (unsigned n = 0; n < sides.size(); n++) {
+    Side const &side = sides[n];
+    if (n == 0 || side.a != sides[n - 1].a || side.b != sides[n - 1].b) {
+      Edge edge = {{side.a, side.b}, side.triangle};
+      m_edges.push_back(edge);
+    }
+    m_triangles[side.triangle].edge[side.corner] = m_edges.size() - 1;
+  }
+}
+
+void ClothCollision::update(std::vector<Vec3f> const &positions,
+                            ThreadPool &pool) {
+  unsigned count = m_triangles.size();
+  m_boxes.resize(count);
+  for (unsigned t = 0; t < count; t++) {
+    Aabb box = Aabb::empty();
+    for (unsigned k = 0; k < 3; k++)
+      box.grow(positions[m_triangles[t].v[k]]);
+    m_boxes[t] = box;
+  }
+  fitHierarchy(pool);
+}
+
+void ClothCollision::fitHierarchy(ThreadPool &pool) {
+  if (m_bvh.primitiveCount() != m_boxes.size()) {
+    m_bvh.build(m_boxes, m_codes, pool);
+    m_patches.resize(2 * m_boxes.size() - 1);
+    fitPatches(m_bvh.root());
+  } else {
+    m_bvh.refit(m_boxes, pool);
+  }
+}
+
+ClothCollision::Patch ClothCollision::fitPatches(int node) {
+  Bvh::Node const &n = m_bvh.node(node);
+  Patch patch;
+  if (n.primitive >= 0) {
+    unsigned quad = n.primitive / 2;
+    unsigned column = quad % (m_length - 1), row = quad / (m_length - 1);
+    Patch leaf = {{column, column + 1}, {row, row + 1}};
+    patch = leaf;
+  } else {
+    Patch left = fitPatches(n.left);
+    Patch right = fitPatches(n.right);
+    Patch both = {{std::min(left.column[0], right.column[0]),
+                   std::max(left.column[1], right.column[1])},
+                  {std::min(left.row[0], right.row[0]),
+                   std::max(left.row[1], right.row[1])}};
+    patch = both;
+  }
+  m_patches[node] = patch;
+  return patch;
+}
+
+// Marks the patches whose insides the next query can skip, for a step from
+// start to end; the same positions twice for a proximity query.
+void ClothCollision::findSmoothPatches(std::vector<Vec3f> const &start,
+                                       std::vector<Vec3f> const &end) {
+  m_smoothTriangles = 0;
+  m_smooth.assign(m_patches.size(), 0);
+  if (m_patches.empty())
+    return;
+  m_cones.resize(m_patches.size());
+  fitCones(m_bvh.root(), start, end);
+  markSmooth(m_bvh.root(), start, end);
+}
+
+ClothCollision::Cone ClothCollision::fitCones(int node,
+                                              std::vector<Vec3f> const &start,
+                                              std::vector<Vec3f> const &end) {
+  Bvh::Node const &n = m_bvh.node(node);
+  Cone cone;
+  if (n.primitive >= 0) {
+    // n(t) = (1-t)^2 a + 2t(1-t) b + t^2 c, which stays inside any cone
+    // holding a, b and c
+    unsigned const *v = m_triangles[n.primitive].v;
+    Vec3f u0 = start[v[1]] - start[v[0]], w0 = start[v[2]] - start[v[0]];
+    Vec3f u1 = end[v[1]] - end[v[0]], w1 = end[v[2]] - end[v[0]];
+    Vec3f a = u0 ^ w0, c = u1 ^ w1;
+    Vec3f b = 0.5f * ((u0 ^ w1) + (u1 ^ w0));
+    float lengthA = a.length(), lengthB = b.length(), lengthC = c.length();
+    Cone any = {Vec3f(0, 0, 1), pi};
+    cone = any;
+    if (lengthA > 0 && lengthC > 0) {
+      Cone coneA = {a / lengthA, 0}, coneC = {c / lengthC, 0};
+      cone = mergeCones(coneA, coneC);
+      if (lengthB > 0) {
+        Cone coneB = {b / lengthB, 0};
+        cone = mergeCones(cone, coneB);
+      }
+    }
+  } else {
+    cone = mergeCones(fitCones(n.left, start, end),
+                      fitCones(n.right, start, end));
+  }
+  m_cones[node] = cone;
+  return cone;
+}
+
+void ClothCollision::markSmooth(int node, std::vector<Vec3f> const &start,
+                                std::vector<Vec3f> const &end) {
+  Bvh::Node const &n = m_bvh.node(node);
+  if (n.primitive >= 0)
+    return;
+
+  Patch const &patch = m_patches[node];
+  if (m_cones[node].angle < maxConeAngle &&
+      starShaped(patch, m_cones[node].axis, start, end)) {
+    m_smooth[node] = 1;
+    m_smoothTriangles += 2 * (patch.column[1] - patch.column[0]) *
+                         (patch.row[1] - patch.row[0]);
+    return;
+  }
+  markSmooth(n.left, start, end);
+  markSmooth(n.right, start, end);
+}
+
+// Whether the border of the patch, projected onto the plane across axis,
+// is star shaped around the centre of its vertices at every moment of the
+// step: every edge has to turn the same way around it, and all of them
+// once round in all. An edge's turn is a quadratic in time, positive if its
+// three control points are.
+bool ClothCollision::starShaped(Patch const &patch, Vec3f const &axis,
+                                std::vector<Vec3f> const &start,
+                                std::vector<Vec3f> const &end) {
+  m_contour.clear();
+  unsigned c0 = patch.column[0], c1 = patch.column[1];
+  unsigned r0 = patch.row[0], r1 = patch.row[1];
+  for (unsigned c = c0; c < c1; c++)
+    m_contour.push_back(r0 * m_length + c);
+  for (unsigned r = r0; r < r1; r++)
+    m_contour.push_back(r * m_length + c1);
+  for (unsigned c = c1; c > c0; c--)
+    m_contour.push_back(r1 * m_length + c);
+  for (unsigned r = r1; r > r0; r--)
+    m_contour.push_back(r * m_length + c0);
+
+  Vec3f side = std::abs(axis.x()) < 0.9f ? Vec3f(1, 0, 0) : Vec3f(0, 1, 0);
+  Vec3f u = (axis ^ side).normalized();
+  Vec3f w = axis ^ u;
+  unsigned count = m_contour.size();
+  m_projected.resize(4 * count);
+  float centre[4] = {0, 0, 0, 0};
+  for (unsigned k = 0; k < count; k++) {
+    Vec3f const &p = start[m_contour[k]];
+    Vec3f const &q = end[m_contour[k]];
+    float *projected = &m_projected[4 * k];
+    projected[0] = p * u;
+    projected[1] = p * w;
+    projected[2] = q * u;
+    projected[3] = q * w;
+    for (unsigned i = 0; i < 4; i++)
+      centre[i] += projected[i];
+  }
+  for (unsigned i = 0; i < 4; i++)
+    centre[i] /= count;
+
+  float sign = 0;
+  float turning = 0;
+  for (unsigned k = 0; k < count; k++) {
+    float const *p = &m_projected[4 * k];
+    float const *q = &m_projected[4 * ((k + 1) % count)];
+    float a0x = p[0] - centre[0], a0y = p[1] - centre[1];
+    float a1x = p[2] - centre[2], a1y = p[3] - centre[3];
+    float b0x = q[0] - centre[0], b0y = q[1] - centre[1];
+    float b1x = q[2] - centre[2], b1y = q[3] - centre[3];
+    float first = cross2(a0x, a0y, b0x, b0y);
+    float middle = 0.5f * (cross2(a0x, a0y, b1x, b1y) +
+                           cross2(a1x, a1y, b0x, b0y));
+    float last = cross2(a1x, a1y, b1x, b1y);
+    if (sign == 0)
+      sign = first > 0 ? 1 : -1;
+    if (!(sign * first > 0 && sign * middle > 0 && sign * last > 0))
+      return false;
+    turning += std::atan2(first, a0x * b0x + a0y * b0y);
+  }
+  return std::abs(turning) < 3 * pi;
+}
+
+// Pairs closer than reach come out, with the depth negative for the ones
+// still further apart than the thickness.
+void ClothCollision::vertexTriangle(std::vector<Vec3f> const &positions,
+                                    unsigned vertex, unsigned triangle,
+                                    float reach,
+                                    std::vector<Contact> &out) const {
+  Triangle const &tri = m_triangles[triangle];
+  if (tri.v[0] == vertex || tri.v[1] == vertex || tri.v[2] == vertex)
+    return;
+
+  Vec3f const &p = positions[vertex];
+  float bary[3];
+  closestOnTriangle(p, positions[tri.v[0]], positions[tri.v[1]],
+                    positions[tri.v[2]], bary);
+  Vec3f q = bary[0] * positions[tri.v[0]] + bary[1] * positions[tri.v[1]] +
+            bary[2] * positions[tri.v[2]];
+  float distance = (p - q).length();
+  if (distance >= reach)
+    return;
+
+  // right on the surface there's no direction between the two, so fall back
+  // to the face normal
+  Vec3f normal;
+  if (distance > 1e-6f * m_thickness) {
+    normal = (p - q) / distance;
+  } else {
+    normal = (positions[tri.v[1]] - positions[tri.v[0]]) ^
+             (positions[tri.v[2]] - positions[tri.v[0]]);
+    float area = normal.length();
+    if (area == 0)
+      return;
+    normal /= area;
+  }
+
+  Contact contact = {{vertex, tri.v[0], tri.v[1], tri.v[2]},
+                     {1, -bary[0], -bary[1], -bary[2]},
+                     normal,
+                     m_thickness - distance,
+                     0,
+                     false,
+                     {vertex, triangle},
+                     0};
+  out.push_back(contact);
+}
+
+void ClothCollision::edgeEdge(std::vector<Vec3f> const &positions, unsigned e,
+                              unsigned f, float reach,
+                              std::vector<Contact> &out) const {
+  unsigned const *a = m_edges[e].v;
+  unsigned const *b = m_edges[f].v;
+  if (a[0] == b[0] || a[0] == b[1] || a[1] == b[0] || a[1] == b[1])
+    return;
+
+  Vec3f const &p1 = positions[a[0]];
+  Vec3f const &q1 = positions[a[1]];
+  Vec3f const &p2 = positions[b[0]];
+  Vec3f const &q2 = positions[b[1]];
+  for (int axis = 0; axis < 3; axis++) {
+    float lowA = std::min(p1[axis], q1[axis]);
+    float highA = std::max(p1[axis], q1[axis]);
+    float lowB = std::min(p2[axis], q2[axis]);
+    float highB = std::max(p2[axis], q2[axis]);
+    if (lowA - highB >= reach || lowB - highA >= reach)
+      return;
+  }
+
+  float s, t;
+  closestOnSegments(p1, q1, p2, q2, s, t);
+  Vec3f d = (p1 + s * (q1 - p1)) - (p2 + t * (q2 - p2));
+  float distance = d.length();
+  if (distance >= reach || distance <= 1e-6f * m_thickness)
+    return;
+
+  Contact contact = {{a[0], a[1], b[0], b[1]},
+                     {1 - s, s, -(1 - t), -t},
+                     d / distance,
+                     m_thickness - distance,
+                     0,
+                     true,
+                     {e, f},
+                     0};
+  out.push_back(contact);
+}
+
+void ClothCollision::trianglePair(std::vector<Vec3f> const &positions,
+                                  unsigned a, unsigned b, float reach,
+                                  std::vector<Contact> &out) const {
+  Triangle const &ta = m_triangles[a];
+  Triangle const &tb = m_triangles[b];
+
+  // Neighbours in the lattice always overlap, but their features only come
+  // within the thickness if the cloth folds flat inside a single quad.
+  for (unsigned i = 0; i < 3; i++) {
+    for (unsigned j = 0; j < 3; j++) {
+      if (ta.v[i] == tb.v[j])
+        return;
+    }
+  }
+
+  for (unsigned k = 0; k < 3; k++) {
+    if (m_vertexOwner[ta.v[k]] == a &&
+        m_boxes[b].overlaps(Aabb::around(positions[ta.v[k]], reach)))
+      vertexTriangle(positions, ta.v[k], b, reach, out);
+  }
+  for (unsigned k = 0; k < 3; k++) {
+    if (m_vertexOwner[tb.v[k]] == b &&
+        m_boxes[a].overlaps(Aabb::around(positions[tb.v[k]], reach)))
+      vertexTriangle(positions, tb.v[k], a, reach, out);
+  }
+
+  for (unsigned i = 0; i < 3; i++) {
+    if (m_edges[ta.edge[i]].owner != a)
+      continue;
+    for (unsigned j = 0; j < 3; j++) {
+      if (m_edges[tb.edge[j]].owner == b)
+        edgeEdge(positions, ta.edge[i], tb.edge[j], reach, out);
+    }
+  }
+}
+
+void ClothCollision::findContacts(std::vector<Vec3f> const &positions,
+                                  ThreadPool &pool) {
+  // every task of the self query has its own output, so the contacts come
+  // out in the same order whatever the thread count
+  m_chunkContacts.resize(m_bvh.selfTaskCount());
+  for (unsigned task = 0; task < m_chunkContacts.size(); task++)
+    m_chunkContacts[task].clear();
+
+  findSmoothPatches(positions, positions);
+  float reach = m_thickness + m_skin;
+  m_bvh.selfQuery(reach, pool, [&](int node) { return m_smooth[node] != 0; },
+                  [&](unsigned task, unsigned a, unsigned b) {
+                    trianglePair(positions, a, b, reach,
+                                 m_chunkContacts[task]);
+                  });
+  gatherContacts();
+
+  // a pair that was cached before keeps its impulse
+  std::vector<CachedPair> previous;
+  previous.swap(m_cache);
+  m_cache.reserve(previous.capacity());
+  for (unsigned n = 0; n < m_contacts.size(); n++) {
+    CachedPair pair;
+    cache(positions, m_contacts[n], pair);
+    m_cache.push_back(pair);
+  }
+  std::sort(m_cache.begin(), m_cache.end(), keyLess<CachedPair>);
+
+  unsigned old = 0;
+  for (unsigned n = 0; n < m_cache.size(); n++) {
+    while (old < previous.size() && previous[old].key < m_cache[n].key)
+      old++;
+    if (old < previous.size() && previous[old].key == m_cache[n].key)
+      m_cache[n].contact.impulse = previous[old].contact.impulse;
+  }
+  m_reused = 0;
+  publishCache();
+}
+
+// Only the pairs whose vertices have moved apart, or closer together, by
+// more than the tolerance since they were last tested are tested again. A
+// pair that moves as one keeps its normal and depth.
+void ClothCollision::refreshContacts(std::vector<Vec3f> const &positions) {
+  float reach = m_thickness + m_skin;
+  float tolerance = m_tolerance * m_tolerance;
+  unsigned kept = 0;
+  m_reused = 0;
+  for (unsigned n = 0; n < m_cache.size(); n++) {
+    CachedPair &pair = m_cache[n];
+    Contact const &contact = pair.contact;
+    Vec3f shift = positions[contact.vertex[0]] - pair.at[0];
+    float moved = 0;
+    for (unsigned k = 1; k < 4; k++) {
+      Vec3f relative = positions[contact.vertex[k]] - pair.at[k] - shift;
+      moved = std::max(moved, relative * relative);
+    }
+
+    if (moved < tolerance) {
+      m_reused++;
+    } else {
+      m_retest.clear();
+      if (contact.edges)
+        edgeEdge(positions, contact.feature[0], contact.feature[1], reach,
+                 m_retest);
+      else
+        vertexTriangle(positions, contact.feature[0], contact.feature[1],
+                       reach, m_retest);
+      // gone past the skin, it is dropped until a full pass finds it again
+      if (m_retest.empty())
+        continue;
+      float impulse = contact.impulse;
+      cache(positions, m_retest[0], pair);
+      pair.contact.impulse = impulse;
+    }
+    m_cache[kept++] = pair;
+  }
+  m_cache.resize(kept);
+  publishCache();
+}
+
+void ClothCollision::cache(std::vector<Vec3f> const &positions,
+                           Contact const &contact, CachedPair &pair) const {
+  pair.key = (static_cast<unsigned long long>(contact.edges) << 63) |
+             (static_cast<unsigned long long>(contact.feature[0]) << 32) |
+             contact.feature[1];
+  pair.contact = contact;
+  for (unsigned k = 0; k < 4; k++)
+    pair.at[k] = positions[contact.vertex[k]];
+}
+
+// The contacts are the cached pairs within the thickness. One that has come
+// apart forgets its impulse, so it starts from nothing when it touches again.
+void ClothCollision::publishCache() {
+  m_contacts.clear();
+  m_contactPair.clear();
+  for (unsigned n = 0; n < m_cache.size(); n++) {
+    Contact &contact = m_cache[n].contact;
+    if (contact.depth <= 0) {
+      contact.impulse = 0;
+      continue;
+    }
+    m_contacts.push_back(contact);
+    m_contactPair.push_back(n);
+  }
+}
+
+void ClothCollision::gatherContacts() {
+  m_contacts.clear();
+  for (unsigned task = 0; task < m_chunkContacts.size(); task++)
+    m_contacts.insert(m_contacts.end(), m_chunkContacts[task].begin(),
+                      m_chunkContacts[task].end());
+}
+
+void ClothCollision::vertexTriangleImpact(std::vector<Vec3f> const &start,
+                                          std::vector<Vec3f> const &end,
+                                          unsigned vertex, unsigned triangle,
+                                          std::vector<Contact> &out) const {
+  // the features can only touch if their swept boxes do
+  unsigned const *v = m_triangles[triangle].v;
+  if (!sweptBox(start, end, v, 3, m_impactTolerance)
+           .overlaps(sweptBox(start, end, &vertex, 1, 0)))
+    return;
+
+  unsigned ids[4] = {vertex, v[0], v[1], v[2]};
+  Vec3f x[4], u[4];
+  for (unsigned k = 0; k < 4; k++) {
+    x[k] = start[ids[k]];
+    u[k] = end[ids[k]] - start[ids[k]];
+  }
+
+  double times[3];
+  unsigned count = coplanarTimes(x[2] - x[1], x[3] - x[1], x[0] - x[1],
+                                 u[2] - u[1], u[3] - u[1], u[0] - u[1], times);
+  for (unsigned r = 0; r < count; r++) {
+    float t = times[r];
+    Vec3f p[4];
+    for (unsigned k = 0; k < 4; k++)
+      p[k] = x[k] + t * u[k];
+
+    float bary[3];
+    closestOnTriangle(p[0], p[1], p[2], p[3], bary);
+    Vec3f q = bary[0] * p[1] + bary[1] * p[2] + bary[2] * p[3];
+    if ((p[0] - q).length() >= m_impactTolerance)
+      continue;
+
+    Vec3f normal = (p[2] - p[1]) ^ (p[3] - p[1]);
+    float area = normal.length();
+    if (area == 0)
+      continue;
+    normal /= area;
+
+    float weight[4] = {1, -bary[0], -bary[1], -bary[2]};
+    Vec3f motion = u[0] - bary[0] * u[1] - bary[1] * u[2] - bary[2] * u[3];
+    if (motion * normal > 0)
+      normal = -normal;
+
+    Contact contact = {{ids[0], ids[1], ids[2], ids[3]},
+                       {weight[0], weight[1], weight[2], weight[3]},
+                       normal,
+                       0,
+                       t,
+                       false,
+                       {vertex, triangle},
+                       0};
+    out.push_back(contact);
+    return;
+  }
+}
+
+void ClothCollision::edgeEdgeImpact(std::vector<Vec3f> const &start,
+                                    std::vector<Vec3f> const &end, unsigned e,
+                                    unsigned f,
+                                    std::vector<Contact> &out) const {
+  if (!sweptBox(start, end, m_edges[e].v, 2, m_impactTolerance)
+           .overlaps(sweptBox(start, end, m_edges[f].v, 2, 0)))
+    return;
+
+  unsigned ids[4] = {m_edges[e].v[0], m_edges[e].v[1], m_edges[f].v[0],
+                     m_edges[f].v[1]};
+  Vec3f x[4], u[4];
+  for (unsigned k = 0; k < 4; k++) {
+    x[k] = start[ids[k]];
+    u[k] = end[ids[k]] - start[ids[k]];
+  }
+
+  double times[3];
+  unsigned count = coplanarTimes(x[1] - x[0], x[3] - x[2], x[2] - x[0],
+                                 u[1] - u[0], u[3] - u[2], u[2] - u[0], times);
+  for (unsigned r = 0; r < count; r++) {
+    float t = times[r];
+    Vec3f p[4];
+    for (unsigned k = 0; k < 4; k++)
+      p[k] = x[k] + t * u[k];
+
+    float a, b;
+    closestOnSegments(p[0], p[1], p[2], p[3], a, b);
+    Vec3f d = (p[0] + a * (p[1] - p[0])) - (p[2] + b * (p[3] - p[2]));
+    if (d.length() >= m_impactTolerance)
+      continue;
+
+    // parallel edges have no plane between them, use the gap instead
+    Vec3f normal = (p[1] - p[0]) ^ (p[3] - p[2]);
+    float length = normal.length();
+    if (length < 1e-6f * (p[1] - p[0]).length() * (p[3] - p[2]).length()) {
+      normal = d;
+      length = normal.length();
+      if (length == 0)
+        continue;
+    }
+    normal /= length;
+
+    float weight[4] = {1 - a, a, -(1 - b), -b};
+    Vec3f motion = weight[0] * u[0] + weight[1] * u[1] + weight[2] * u[2] +
+                   weight[3] * u[3];
+    if (motion * normal > 0)
+      normal = -normal;
+
+    Contact contact = {{ids[0], ids[1], ids[2], ids[3]},
+                       {weight[0], weight[1], weight[2], weight[3]},
+                       normal,
+                       0,
+                       t,
+                       true,
+                       {e, f},
+                       0};
+    out.push_back(contact);
+    return;
+  }
+}
+
+void ClothCollision::sweptPair(std::vector<Vec3f> const &start,
+                               std::vector<Vec3f> const &end, unsigned a,
+                               unsigned b, std::vector<Contact> &out) const {
+  Triangle const &ta = m_triangles[a];
+  Triangle const &tb = m_triangles[b];
+  for (unsigned i = 0; i < 3; i++) {
+    for (unsigned j = 0; j < 3; j++) {
+      if (ta.v[i] == tb.v[j])
+        return;
+    }
+  }
+
+  for (unsigned k = 0; k < 3; k++) {
+    if (m_vertexOwner[ta.v[k]] == a)
+      vertexTriangleImpact(start, end, ta.v[k], b, out);
+  }
+  for (unsigned k = 0; k < 3; k++) {
+    if (m_vertexOwner[tb.v[k]] == b)
+      vertexTriangleImpact(start, end, tb.v[k], a, out);
+  }
+
+  for (unsigned i = 0; i < 3; i++) {
+    if (m_edges[ta.edge[i]].owner != a)
+      continue;
+    for (unsigned j = 0; j < 3; j++) {
+      if (m_edges[tb.edge[j]].owner == b)
+        edgeEdgeImpact(start, end, ta.edge[i], tb.edge[j], out);
+    }
+  }
+}
+
+void ClothCollision::findImpacts(std::vector<Vec3f> const &start,
+                                 std::vector<Vec3f> const &end,
+                                 ThreadPool &pool) {
+  unsigned count = m_triangles.size();
+  m_boxes.resize(count);
+  for (unsigned t = 0; t < count; t++)
+    m_boxes[t] = sweptBox(start, end, m_triangles[t].v, 3, 0);
+  fitHierarchy(pool);
+
+  m_chunkContacts.resize(m_bvh.selfTaskCount());
+  for (unsigned task = 0; task < m_chunkContacts.size(); task++)
+    m_chunkContacts[task].clear();
+
+  findSmoothPatches(start, end);
+  m_bvh.selfQuery(m_impactTolerance, pool,
+                  [&](int node) { return m_smooth[node] != 0; },
+                  [&](unsigned task, unsigned a, unsigned b) {
+                    sweptPair(start, end, a, b, m_chunkContacts[task]);
+                  });
+  gatherContacts();
+}
+
+void ClothCollision::findNearImpacts(std::vector<Vec3f> const &start,
+                                     std::vector<Vec3f> const &end) {
+  m_contacts.clear();
+  for (unsigned n = 0; n < m_cache.size(); n++) {
+    Contact const &near = m_cache[n].contact;
+    if (near.edges)
+      edgeEdgeImpact(start, end, near.feature[0], near.feature[1], m_contacts);
+    else
+      vertexTriangleImpact(start, end, near.feature[0], near.feature[1],
+                           m_contacts);
+  }
+}
@@ -0,0 +1,523 @@
+/**
+ * File:	Collider.cpp
+ */
+
+#include "Collider.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+float const farAway = std::numeric_limits<float>::max();
+float const tiny = 1e-12f;
+int const maxSweepSteps = 64;
+
+// a if mask is 1, b if it's 0. The loops over the masses pick with this
+// rather than ?:, which the compiler turns back into branches often enough
+// to stop it vectorising them.
+inline float blend(float mask, float a, float b) {
+  return mask * a + (1 - mask) * b;
+}
+
+// The fields return the signed distance at (x, y, z) and put its gradient,
+// a unit vector, in g. They are written with blends only, so the loop of
+// closestTo() runs them on several masses at once.
+
+struct PlaneField {
+  float nx, ny, nz, offset;
+
+  float operator()(float x, float y, float z, float g[3]) const {
+    g[0] = nx;
+    g[1] = ny;
+    g[2] = nz;
+    return nx * x + ny * y + nz * z - offset;
+  }
+};
+
+struct BoxField {
+  float cx, cy, cz;   // centre
+  float hx, hy, hz;   // half extents
+
+  float operator()(float x, float y, float z, float g[3]) const {
+    float px = x - cx, py = y - cy, pz = z - cz;
+    float qx = std::fabs(px) - hx;
+    float qy = std::fabs(py) - hy;
+    float qz = std::fabs(pz) - hz;
+
+    float ox = std::max(qx, 0.f), oy = std::max(qy, 0.f);
+    float oz = std::max(qz, 0.f);
+    float outside = std::sqrt(ox * ox + oy * oy + oz * oz);
+    float inside = std::min(std::max(qx, std::max(qy, qz)), 0.f);
+
+    // inside, the way out is through the closest face
+    float ix = float(qx >= qy) * float(qx >= qz);
+    float iy = (1 - ix) * float(qy >= qz);
+    float iz = 1 - ix - iy;
+
+    float inv = 1 / std::max(outside, tiny);
+    float out = float(outside > 0);
+    g[0] = std::copysign(blend(out, ox * inv, ix), px);
+    g[1] = std::copysign(blend(out, oy * inv, iy), py);
+    g[2] = std::copysign(blend(out, oz * inv, iz), pz);
+    return outside + inside;
+  }
+};
+
+// round at the sphere's centre, for the sphere, or along a segment
+struct CapsuleField {
+  float ax, ay, az;
+  float abx, aby, abz;
+  float invLengthSq;  // 0 for a sphere
+  float radius;
+
+  float operator()(float x, float y, float z, float g[3]) const {
+    float px = x - ax, py = y - ay, pz = z - az;
+    float t = (px * abx + py * aby + pz * abz) * invLengthSq;
+    t = std::min(std::max(t, 0.f), 1.f);
+    float dx = px - t * abx, dy = py - t * aby, dz = pz - t * abz;
+    float length = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+    // right on the axis any direction is as good, so take up
+    float inv = 1 / std::max(length, tiny);
+    float off = float(length > 0);
+    g[0] = blend(off, dx * inv, 0);
+    g[1] = blend(off, dy * inv, 1);
+    g[2] = blend(off, dz * inv, 0);
+    return length - radius;
+  }
+};
+
+struct VoxelField {
+  float const *values;
+  float ox, oy, oz;
+  float cellSize, invCellSize;
+  int nx, ny;
+  float maxX, maxY, maxZ;   // last node, as a coordinate
+
+  float operator()(float x, float y, float z, float g[3]) const {
+    float ux = (x - ox) * invCellSize;
+    float uy = (y - oy) * invCellSize;
+    float uz = (z - oz) * invCellSize;
+    float cx = std::min(std::max(ux, 0.f), maxX);
+    float cy = std::min(std::max(uy, 0.f), maxY);
+    float cz = std::min(std::max(uz, 0.f), maxZ);
+
+    // the cell holding the clamped point, the last one for the far faces
+    int ix = std::min(static_cast<int>(cx), static_cast<int>(maxX) - 1);
+    int iy = std::min(static_cast<int>(cy), static_cast<int>(maxY) - 1);
+    int iz = std::min(static_cast<int>(cz), static_cast<int>(maxZ) - 1);
+    float fx = cx - ix, fy = cy - iy, fz = cz - iz;
+
+    float const *v = values + (iz * ny + iy) * nx + ix;
+    int sy = nx, sz = nx * ny;
+    float v000 = v[0], v100 = v[1];
+    float v010 = v[sy], v110 = v[sy + 1];
+    float v001 = v[sz], v101 = v[sz + 1];
+    float v011 = v[sz + sy], v111 = v[sz + sy + 1];
+
+    float x00 = v000 + fx * (v100 - v000), x10 = v010 + fx * (v110 - v010);
+    float x01 = v001 + fx * (v101 - v001), x11 = v011 + fx * (v111 - v011);
+    float y0 = x00 + fy * (x10 - x00), y1 = x01 + fy * (x11 - x01);
+    float inside = y0 + fz * (y1 - y0);
+
+    float dx0 = (v100 - v000) + fy * ((v110 - v010) - (v100 - v000));
+    float dx1 = (v101 - v001) + fy * ((v111 - v011) - (v101 - v001));
+    float gx = dx0 + fz * (dx1 - dx0);
+    float gy = (x10 - x00) + fz * ((x11 - x01) - (x10 - x00));
+    float gz = y1 - y0;
+
+    // off the grid, head back to it first
+    float ex = (ux - cx) * cellSize, ey = (uy - cy) * cellSize;
+    float ez = (uz - cz) * cellSize;
+    float outside = std::sqrt(ex * ex + ey * ey + ez * ez);
+    gx += ex;
+    gy += ey;
+    gz += ez;
+
+    float length = std::sqrt(gx * gx + gy * gy + gz * gz);
+    float inv = 1 / std::max(length, tiny);
+    float any = float(length > 0);
+    g[0] = blend(any, gx * inv, 0);
+    g[1] = blend(any, gy * inv, 1);
+    g[2] = blend(any, gz * inv, 0);
+    return inside + outside;
+  }
+};
+
+// Keeps the obstacle of field in the batch scratch wherever it's the
+// closest so far.
+template <class Field>
+void closestTo(Field const &field, ColliderMaterial const &material,
+               unsigned begin, unsigned end, float const *__restrict x,
+               float const *__restrict y, float const *__restrict z,
+               float *__restrict phi, float *__restrict nx,
+               float *__restrict ny, float *__restrict nz,
+               float *__restrict restitution, float *__restrict slip,
+               float *__restrict restSlip, float *__restrict restSpeed) {
+  for (unsigned i = begin; i < end; i++) {
+    float g[3];
+    float d = field(x[i], y[i], z[i], g);
+    float closer = float(d < phi[i]);
+    phi[i] = std::min(d, phi[i]);
+    nx[i] = blend(closer, g[0], nx[i]);
+    ny[i] = blend(closer, g[1], ny[i]);
+    nz[i] = blend(closer, g[2], nz[i]);
+    restitution[i] = blend(closer, material.restitution, restitution[i]);
+    slip[i] = blend(closer, material.slip, slip[i]);
+    restSlip[i] = blend(closer, material.restSlip, restSlip[i]);
+    restSpeed[i] = blend(closer, material.restSpeed, restSpeed[i]);
+  }
+}
+
+// A mass that starts its step on a surface, to within the tolerance, is held
+// to the surface's tangent plane there rather than to wherever the end of
+// its step is closest to, which might be the far side of a thin obstacle or
+// nothing at all if it stepped right through.
+void touchStartSurface(unsigned count, float tolerance,
+                       float const *__restrict x, float const *__restrict y,
+                       float const *__restrict z, float const *__restrict sx,
+                       float const *__restrict sy, float const *__restrict sz,
+                       float const *__restrict startPhi,
+                       float const *__restrict startNx,
+                       float const *__restrict startNy,
+                       float const *__restrict startNz,
+                       float *__restrict phi, float *__restrict nx,
+                       float *__restrict ny, float *__restrict nz) {
+  for (unsigned i = 0; i < count; i++) {
+    float dx = x[i] - sx[i], dy = y[i] - sy[i], dz = z[i] - sz[i];
+    float plane = startPhi[i] + dx * startNx[i] + dy * startNy[i] +
+                  dz * startNz[i];
+    float touching = float(std::fabs(startPhi[i]) < tolerance);
+    phi[i] = blend(touching, plane, phi[i]);
+    nx[i] = blend(touching, startNx[i], nx[i]);
+    ny[i] = blend(touching, startNy[i], ny[i]);
+    nz[i] = blend(touching, startNz[i], nz[i]);
+  }
+}
+
+// Puts the masses inside an obstacle back onto its surface, and stops or
+// bounces the ones still heading in. A mass that comes to rest also keeps
+// only restSlip of the way it slid along the surface during the step, or
+// friction would stop its velocity but not its creep.
+void respond(unsigned count, float *__restrict x, float *__restrict y,
+             float *__restrict z, float *__restrict vx, float *__restrict vy,
+             float *__restrict vz, float const *__restrict sx,
+             float const *__restrict sy, float const *__restrict sz,
+             float const *__restrict phi,
+             float const *__restrict nx, float const *__restrict ny,
+             float const *__restrict nz, float const *__restrict restitution,
+             float const *__restrict slip, float const *__restrict restSlip,
+             float const *__restrict restSpeed) {
+  for (unsigned i = 0; i < count; i++) {
+    float depth = std::min(phi[i], 0.f);
+    x[i] -= depth * nx[i];
+    y[i] -= depth * ny[i];
+    z[i] -= depth * nz[i];
+
+    float vn = vx[i] * nx[i] + vy[i] * ny[i] + vz[i] * nz[i];
+    float tx = vx[i] - vn * nx[i];
+    float ty = vy[i] - vn * ny[i];
+    float tz = vz[i] - vn * nz[i];
+    float bounce = -restitution[i] * vn;
+    float rests = float(bounce < restSpeed[i]);
+    float keep = blend(rests, restSlip[i], slip[i]);
+    float away = blend(rests, 0, bounce);
+    float hit = float(phi[i] <= 0) * float(vn < 0);
+    vx[i] = blend(hit, keep * tx + away * nx[i], vx[i]);
+    vy[i] = blend(hit, keep * ty + away * ny[i], vy[i]);
+    vz[i] = blend(hit, keep * tz + away * nz[i], vz[i]);
+
+    float dx = x[i] - sx[i], dy = y[i] - sy[i], dz = z[i] - sz[i];
+    float dn = dx * nx[i] + dy * ny[i] + dz * nz[i];
+    float held = hit * rests * (1 - restSlip[i]);
+    x[i] -= held * (dx - dn * nx[i]);
+    y[i] -= held * (dy - dn * ny[i]);
+    z[i] -= held * (dz - dn * nz[i]);
+  }
+}
+
+// unsigned distance from p to the segment ab
+float segmentDistance(Vec3f const &p, Vec3f const &a, Vec3f const &b) {
+  Vec3f ab = b - a;
+  float lengthSq = ab * ab;
+  float t = lengthSq > 0 ? ((p - a) * ab) / lengthSq : 0;
+  t = std::min(std::max(t, 0.f), 1.f);
+  return (p - (a + t * ab)).length();
+}
+
+// unsigned distance from p to the triangle abc
+float triangleDistance(Vec3f const &p, Vec3f const &a, Vec3f const &b,
+                       Vec3f const &c) {
+  Vec3f normal = (b - a) ^ (c - a);
+  float area = normal.length();
+  if (area > 0) {
+    normal /= area;
+    Vec3f q = p - ((p - a) * normal) * normal;
+
+    // the projection is inside when it's on the inner side of every edge
+    if ((((b - a) ^ (q - a)) * normal) >= 0 &&
+        (((c - b) ^ (q - b)) * normal) >= 0 &&
+        (((a - c) ^ (q - c)) * normal) >= 0)
+      return std::fabs((p - a) * normal);
+  }
+
+  return std::min(segmentDistance(p, a, b),
+                  std::min(segmentDistance(p, b, c), segmentDistance(p, c, a)));
+}
+
+// solid angle abc subtends from p, signed by the triangle's orientation
+// (Van Oosterom and Strackee)
+float solidAngle(Vec3f const &p, Vec3f const &a, Vec3f const &b,
+                 Vec3f const &c) {
+  Vec3f pa = a - p, pb = b - p, pc = c - p;
+  float la = pa.length(), lb = pb.length(), lc = pc.length();
+  float numerator = pa * (pb ^ pc);
+  float denominator = la * lb * lc + (pa * pb) * lc + (pa * pc) * lb +
+                      (pb * pc) * la;
+  return 2 * std::atan2(numerator, denominator);
+}
+
+} // namespace
+
+VoxelSdf::VoxelSdf() : m_cellSize(1) {
+  m_nodes[0] = m_nodes[1] = m_nodes[2] = 0;
+}
+
+void VoxelSdf::bake(std::vector<Vec3f> const &vertices,
+                    std::vector<unsigned> const &indices, float cellSize,
+                    float margin) {
+  m_values.clear();
+  if (vertices.empty() || indices.size() < 3)
+    return;
+
+  Vec3f min = vertices[0], max = vertices[0];
+  for (unsigned i = 1; i < vertices.size(); i++) {
+    for (int axis = 0; axis < 3; axis++) {
+      min[axis] = std::min(min[axis], vertices[i][axis]);
+      max[axis] = std::max(max[axis], vertices[i][axis]);
+    }
+  }
+
+  m_origin = min - Vec3f(margin, margin, margin);
+  m_cellSize = cellSize;
+  for (int axis = 0; axis < 3; axis++) {
+    float extent = max[axis] - min[axis] + 2 * margin;
+    m_nodes[axis] = std::max(2, static_cast<int>(std::ceil(extent /
+                                                           cellSize)) + 1);
+  }
+  m_values.resize(m_nodes[0] * m_nodes[1] * m_nodes[2]);
+
+  float const fourPi = 4 * 3.14159265359f;
+  unsigned triangles = indices.size() / 3;
+  for (unsigned z = 0; z < m_nodes[2]; z++) {
+    for (unsigned y = 0; y < m_nodes[1]; y++) {
+      for (unsigned x = 0; x < m_nodes[0]; x++) {
+        Vec3f p = m_origin + cellSize * Vec3f(x, y, z);
+        float distance = farAway;
+        float winding = 0;
+        for (unsigned t = 0; t < triangles; t++) {
+          Vec3f const &a = vertices[indices[3 * t]];
+          Vec3f const &b = vertices[indices[3 * t + 1]];
+          Vec3f const &c = vertices[indices[3 * t + 2]];
+          distance = std::min(distance, triangleDistance(p, a, b, c));
+          winding += solidAngle(p, a, b, c);
+        }
+
+        // a mesh wound the other way round gives -1 inside
+        bool inside = std::fabs(winding / fourPi) > 0.5f;
+        m_values[(z * m_nodes[1] + y) * m_nodes[0] + x] =
+            inside ? -distance : distance;
+      }
+    }
+  }
+}
+
+void ColliderBatch::resize(unsigned count) {
+  std::vector<float> *arrays[] = {&m_x,  &m_y,  &m_z,  &m_vx, &m_vy,
+                                  &m_vz, &m_sx, &m_sy, &m_sz, &m_phi,
+                                  &m_nx, &m_ny, &m_nz, &m_restitution,
+                                  &m_slip, &m_restSlip, &m_restSpeed,
+                                  &m_startPhi, &m_startNx, &m_startNy,
+                                  &m_startNz};
+  for (unsigned n = 0; n < sizeof(arrays) / sizeof(arrays[0]); n++)
+    arrays[n]->resize(count);
+}
+
+ColliderSet::ColliderSet() : m_sweepTolerance(0.001) {}
+
+void ColliderSet::clear() {
+  m_colliders.clear();
+  m_voxels.clear();
+}
+
+void ColliderSet::addPlane(Vec3f const &normal, float offset,
+                           ColliderMaterial const &material) {
+  Collider c = {PLANE, normal, Vec3f(), offset, 0, material};
+  m_colliders.push_back(c);
+}
+
+void ColliderSet::addBox(Vec3f const &min, Vec3f const &max,
+                         ColliderMaterial const &material) {
+  Collider c = {BOX, 0.5f * (min + max), 0.5f * (max - min), 0, 0, material};
+  m_colliders.push_back(c);
+}
+
+void ColliderSet::addSphere(Vec3f const &centre, float radius,
+                            ColliderMaterial const &material) {
+  Collider c = {SPHERE, centre, Vec3f(), radius, 0, material};
+  m_colliders.push_back(c);
+}
+
+void ColliderSet::addCapsule(Vec3f const &a, Vec3f const &b, float radius,
+                             ColliderMaterial const &material) {
+  Collider c = {CAPSULE, a, b, radius, 0, material};
+  m_colliders.push_back(c);
+}
+
+void ColliderSet::addVoxels(VoxelSdf const &sdf,
+                            ColliderMaterial const &material) {
+  if (sdf.empty())
+    return;
+  Collider c = {VOXELS, Vec3f(), Vec3f(), 0, unsigned(m_voxels.size()),
+                material};
+  m_colliders.push_back(c);
+  m_voxels.push_back(sdf);
+}
+
+void ColliderSet::closest(ColliderBatch &batch, unsigned begin, unsigned end,
+                          float const *x, float const *y,
+                          float const *z) const {
+  std::fill(batch.m_phi.begin() + begin, batch.m_phi.begin() + end, farAway);
+
+  float *phi = &batch.m_phi[0];
+  float *nx = &batch.m_nx[0], *ny = &batch.m_ny[0], *nz = &batch.m_nz[0];
+  float *restitution = &batch.m_restitution[0], *slip = &batch.m_slip[0];
+  float *restSlip = &batch.m_restSlip[0];
+  float *restSpeed = &batch.m_restSpeed[0];
+
+  for (unsigned n = 0; n < m_colliders.size(); n++) {
+    Collider const &c = m_colliders[n];
+    switch (c.shape) {
+    case PLANE: {
+      PlaneField field = {c.a.x(), c.a.y(), c.a.z(), c.radius};
+      closestTo(field, c.material, begin, end, x, y, z, phi, nx, ny, nz,
+                restitution, slip, restSlip, restSpeed);
+      break;
+    }
+    case BOX: {
+      BoxField field = {c.a.x(), c.a.y(), c.a.z(), c.b.x(), c.b.y(), c.b.z()};
+      closestTo(field, c.material, begin, end, x, y, z, phi, nx, ny, nz,
+                restitution, slip, restSlip, restSpeed);
+      break;
+    }
+    case SPHERE:
+    case CAPSULE: {
+      Vec3f ab = c.shape == SPHERE ? Vec3f() : c.b - c.a;
+      float lengthSq = ab * ab;
+      CapsuleField field = {c.a.x(), c.a.y(), c.a.z(),
+                            ab.x(),  ab.y(),  ab.z(),
+                            lengthSq > 0 ? 1 / lengthSq : 0, c.radius};
+      closestTo(field, c.material, begin, end, x, y, z, phi, nx, ny, nz,
+                restitution, slip, restSlip, restSpeed);
+      break;
+    }
+    case VOXELS: {
+      VoxelSdf const &sdf = m_voxels[c.voxels];
+      VoxelField field = {sdf.values(),
+                          sdf.origin().x(),
+                          sdf.origin().y(),
+                          sdf.origin().z(),
+                          sdf.cellSize(),
+                          1 / sdf.cellSize(),
+                          int(sdf.nodes(0)),
+                          int(sdf.nodes(1)),
+                          float(sdf.nodes(0) - 1),
+                          float(sdf.nodes(1) - 1),
+                          float(sdf.nodes(2) - 1)};
+      closestTo(field, c.material, begin, end, x, y, z, phi, nx, ny, nz,
+                restitution, slip, restSlip, restSpeed);
+      break;
+    }
+    }
+  }
+}
+
+void ColliderSet::collide(ColliderBatch &batch) const {
+  unsigned count = batch.size();
+  if (count == 0 || m_colliders.empty())
+    return;
+
+  closest(batch, 0, count, &batch.m_sx[0], &batch.m_sy[0], &batch.m_sz[0]);
+  batch.m_startPhi.swap(batch.m_phi);
+  batch.m_startNx.swap(batch.m_nx);
+  batch.m_startNy.swap(batch.m_ny);
+  batch.m_startNz.swap(batch.m_nz);
+  closest(batch, 0, count, &batch.m_x[0], &batch.m_y[0], &batch.m_z[0]);
+
+  // A mass coming from clear of the obstacles is stopped where its step
+  // first reaches one, not pushed out through the nearest face, which might
+  // be the far side of a thin one. The distance bounds how far an obstacle
+  // can be, so a step no longer than the clearance at its two ends can't
+  // have reached one; those that are longer might have gone right through.
+  batch.m_swept.clear();
+  for (unsigned i = 0; i < count; i++) {
+    float dx = batch.m_x[i] - batch.m_sx[i];
+    float dy = batch.m_y[i] - batch.m_sy[i];
+    float dz = batch.m_z[i] - batch.m_sz[i];
+    float clear = batch.m_startPhi[i] + batch.m_phi[i];
+    if (batch.m_startPhi[i] >= m_sweepTolerance &&
+        (batch.m_phi[i] <= 0 || dx * dx + dy * dy + dz * dz > clear * clear))
+      batch.m_swept.push_back(i);
+  }
+  for (unsigned n = 0; n < batch.m_swept.size(); n++)
+    sweep(batch, batch.m_swept[n]);
+
+  touchStartSurface(count, m_sweepTolerance, &batch.m_x[0], &batch.m_y[0],
+                    &batch.m_z[0], &batch.m_sx[0], &batch.m_sy[0],
+                    &batch.m_sz[0], &batch.m_startPhi[0], &batch.m_startNx[0],
+                    &batch.m_startNy[0], &batch.m_startNz[0], &batch.m_phi[0],
+                    &batch.m_nx[0], &batch.m_ny[0], &batch.m_nz[0]);
+
+  respond(count, &batch.m_x[0], &batch.m_y[0], &batch.m_z[0],
+          &batch.m_vx[0], &batch.m_vy[0], &batch.m_vz[0], &batch.m_sx[0],
+          &batch.m_sy[0], &batch.m_sz[0], &batch.m_phi[0],
+          &batch.m_nx[0], &batch.m_ny[0], &batch.m_nz[0],
+          &batch.m_restitution[0], &batch.m_slip[0], &batch.m_restSlip[0],
+          &batch.m_restSpeed[0]);
+}
+
+// Marches the step of mass i by the distance to the closest obstacle, which
+// can't overshoot a surface, and ends it on the first one it reaches.
+void ColliderSet::sweep(ColliderBatch &batch, unsigned i) const {
+  Vec3f start(batch.m_sx[i], batch.m_sy[i], batch.m_sz[i]);
+  Vec3f end = batch.position(i);
+  float length = (end - start).length();
+  Vec3f direction = (end - start) / length;
+  Vec3f velocity = batch.velocity(i);
+
+  float s = 0;
+  float d = batch.m_startPhi[i];
+  for (int n = 0; n < maxSweepSteps; n++) {
+    if (d < m_sweepTolerance) {
+      batch.set(i, start + s * direction, velocity);
+      closest(batch, i, i + 1, &batch.m_x[0], &batch.m_y[0], &batch.m_z[0]);
+      batch.m_x[i] -= d * batch.m_nx[i];
+      batch.m_y[i] -= d * batch.m_ny[i];
+      batch.m_z[i] -= d * batch.m_nz[i];
+      batch.m_phi[i] = 0;
+      return;
+    }
+
+    s += d;
+    if (s >= length)
+      break;
+    batch.set(i, start + s * direction, velocity);
+    closest(batch, i, i + 1, &batch.m_x[0], &batch.m_y[0], &batch.m_z[0]);
+    d = batch.m_phi[i];
+  }
+
+  batch.set(i, end, velocity);
+  closest(batch, i, i + 1, &batch.m_x[0], &batch.m_y[0], &batch.m_z[0]);
+}
@@ -0,0 +1,66 @@
+/**
+ * File:	GpuTimer.cpp
+ */
+
+#include "GpuTimer.h"
+
+GpuTimer::GpuTimer() : m_next(0), m_timing(false), m_total(0), m_count(0) {
+  for (unsigned q = 0; q < QUERIES; q++) {
+    m_queries[q] = 0;
+    m_pending[q] = false;
+  }
+}
+
+void GpuTimer::create() { glGenQueries(QUERIES, m_queries); }
+
+void GpuTimer::destroy() {
+  glDeleteQueries(QUERIES, m_queries);
+  for (unsigned q = 0; q < QUERIES; q++)
+    m_pending[q] = false;
+}
+
+void GpuTimer::begin() {
+  collect();
+  m_timing = !m_pending[m_next];
+  if (m_timing)
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[m_next]);
+}
+
+void GpuTimer::end() {
+  if (!m_timing)
+    return;
+
+  glEndQuery(GL_TIME_ELAPSED);
+  m_pending[m_next] = true;
+  m_next = (m_next + 1) % QUERIES;
+  m_timing = false;
+}
+
+double GpuTimer::average() {
+  collect();
+  if (m_count == 0)
+    return -1;
+
+  double ms = 1e-6 * double(m_total) / m_count;
+  m_total = 0;
+  m_count = 0;
+  return ms;
+}
+
+void GpuTimer::collect() {
+  for (unsigned q = 0; q < QUERIES; q++) {
+    if (!m_pending[q])
+      continue;
+
+    GLint available = 0;
+    glGetQueryObjectiv(m_queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      continue;
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(m_queries[q], GL_QUERY_RESULT, &elapsed);
+    m_total += elapsed;
+    m_count++;
+    m_pending[q] = false;
+  }
+}
@@ -0,0 +1,196 @@
+/**
+ * File:	HeadlessContext.cpp
+ */
+
+#include "HeadlessContext.h"
+
+#include <cstring>
+#include <iostream>
+
+// from EGL_MESA_platform_surfaceless, which older headers don't have
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+namespace {
+
+typedef EGLDisplay(EGLAPIENTRYP GetPlatformDisplayProc)(
+    EGLenum platform, void *nativeDisplay, EGLint const *attributes);
+
+bool hasClientExtension(char const *name) {
+  char const *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (!extensions)
+    return false;
+
+  std::size_t length = std::strlen(name);
+  for (char const *at = extensions; (at = std::strstr(at, name));
+       at += length) {
+    bool starts = at == extensions || at[-1] == ' ';
+    bool ends = at[length] == ' ' || at[length] == '\0';
+    if (starts && ends)
+      return true;
+  }
+  return false;
+}
+
+EGLDisplay openDisplay() {
+  if (hasClientExtension("EGL_MESA_platform_surfaceless")) {
+    GetPlatformDisplayProc getPlatformDisplay =
+        reinterpret_cast<GetPlatformDisplayProc>(
+            eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (getPlatformDisplay) {
+      EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                              EGL_DEFAULT_DISPLAY, 0);
+      if (display != EGL_NO_DISPLAY)
+        return display;
+    }
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+} // namespace
+
+HeadlessContext::HeadlessContext()
+    : m_display(EGL_NO_DISPLAY), m_surface(EGL_NO_SURFACE),
+      m_context(EGL_NO_CONTEXT), m_width(0), m_height(0), m_framebuffer(0),
+      m_resolve(0) {
+  for (int r = 0; r < 3; r++)
+    m_renderbuffers[r] = 0;
+}
+
+bool HeadlessContext::create() {
+  m_display = openDisplay();
+  EGLint major, minor;
+  if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, &major,
+                                                    &minor)) {
+    std::cerr << "No EGL display" << std::endl;
+    return false;
+  }
+
+  EGLint const configAttributes[] = {EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+                                     EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                     EGL_RED_SIZE,        8,
+                                     EGL_GREEN_SIZE,      8,
+                                     EGL_BLUE_SIZE,       8,
+                                     EGL_NONE};
+  EGLConfig config;
+  EGLint configs = 0;
+  if (!eglChooseConfig(m_display, configAttributes, &config, 1, &configs) ||
+      configs == 0) {
+    std::cerr << "No EGL config with pbuffers and OpenGL" << std::endl;
+    return false;
+  }
+
+  EGLint const surfaceAttributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+  m_surface = eglCreatePbufferSurface(m_display, config, surfaceAttributes);
+
+  EGLint const contextAttributes[] = {
+      EGL_CONTEXT_MAJOR_VERSION,       3,
+      EGL_CONTEXT_MINOR_VERSION,       2,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+      EGL_NONE};
+  eglBindAPI(EGL_OPENGL_API);
+  m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT,
+                               contextAttributes);
+  if (m_surface == EGL_NO_SURFACE || m_context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(m_display, m_surface, m_surface, m_context)) {
+    std::cerr << "No OpenGL 3.2 core context from EGL" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void HeadlessContext::destroy() {
+  if (m_framebuffer) {
+    glDeleteFramebuffers(1, &m_framebuffer);
+    if (m_resolve)
+      glDeleteFramebuffers(1, &m_resolve);
+    glDeleteRenderbuffers(3, m_renderbuffers);
+  }
+
+  if (m_display != EGL_NO_DISPLAY) {
+    eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                   EGL_NO_CONTEXT);
+    if (m_context != EGL_NO_CONTEXT)
+      eglDestroyContext(m_display, m_context);
+    if (m_surface != EGL_NO_SURFACE)
+      eglDestroySurface(m_display, m_surface);
+    eglTerminate(m_display);
+  }
+  *this = HeadlessContext();
+}
+
+void *HeadlessContext::procAddress(char const *name) {
+  return reinterpret_cast<void *>(eglGetProcAddress(name));
+}
+
+// Colour and depth renderbuffers to draw into, and with multisampling a
+// plain colour one for them to resolve into.
+bool HeadlessContext::createFramebuffer(int width, int height, int samples) {
+  m_width = width;
+  m_height = height;
+  if (samples < 2)
+    samples = 0;
+
+  glGenRenderbuffers(3, m_renderbuffers);
+  glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[0]);
+  glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width,
+                                   height);
+  glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[1]);
+  glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples,
+                                   GL_DEPTH_COMPONENT24, width, height);
+
+  glGenFramebuffers(1, &m_framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, m_renderbuffers[0]);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, m_renderbuffers[1]);
+  bool complete =
+      glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+  if (samples > 0) {
+    glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[2]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenFramebuffers(1, &m_resolve);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_resolve);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, m_renderbuffers[2]);
+    complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+                               GL_FRAMEBUFFER_COMPLETE;
+  }
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  bindFramebuffer();
+
+  if (!complete)
+    std::cerr << "Offscreen framebuffer of " << width << "x" << height
+              << " isn't complete" << std::endl;
+  return complete;
+}
+
+void HeadlessContext::bindFramebuffer() {
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glViewport(0, 0, m_width, m_height);
+}
+
+void HeadlessContext::readFrame(std::vector<unsigned char> &pixels) {
+  GLuint source = m_framebuffer;
+  if (m_resolve) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_resolve);
+    glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    source = m_resolve;
+  }
+
+  std::size_t row = std::size_t(m_width) * 3;
+  std::vector<unsigned char> rows(row * m_height);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, source);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, m_width, m_height, GL_RGB, GL_UNSIGNED_BYTE, &rows[0]);
+
+  // GL's rows go up from the bottom
+  pixels.resize(rows.size());
+  for (int y = 0; y < m_height; y++)
+    std::memcpy(&pixels[row * y], &rows[row * (m_height - 1 - y)], row);
+}
@@ -0,0 +1,125 @@
+/**
+ * File:	ImexSolver.cpp
+ */
+
+#include "ImexSolver.h"
+
+void ImexSolver::clear(unsigned n) {
+  m_mass.assign(n, 0);
+  m_rhs.assign(n, Vec3f(0,0,0));
+  m_blocks.clear();
+}
+
+void ImexSolver::setUnknown(unsigned i, float mass, Vec3f const &rhs) {
+  m_mass[i] = mass;
+  m_rhs[i] = rhs;
+}
+
+void ImexSolver::addRhs(unsigned i, Vec3f const &rhs) { m_rhs[i] += rhs; }
+
+void ImexSolver::addSpring(int a, int b, Vec3f const &u, float alpha,
+                           float beta) {
+  Block block;
+  block.a = a;
+  block.b = b;
+  block.u = u;
+  block.alpha = alpha;
+  block.beta = beta;
+  m_blocks.push_back(block);
+}
+
+void ImexSolver::multiply(std::vector<Vec3f> const &in,
+                          std::vector<Vec3f> &out) const {
+  for (unsigned i = 0; i < in.size(); i++)
+    out[i] = m_mass[i] * in[i];
+
+  for (unsigned n = 0; n < m_blocks.size(); n++) {
+    Block const &block = m_blocks[n];
+    Vec3f d(0,0,0);
+    if (block.a >= 0)
+      d += in[block.a];
+    if (block.b >= 0)
+      d -= in[block.b];
+
+    Vec3f Sd = block.alpha * d + (block.beta * (block.u * d)) * block.u;
+    if (block.a >= 0)
+      out[block.a] += Sd;
+    if (block.b >= 0)
+      out[block.b] -= Sd;
+  }
+}
+
+unsigned ImexSolver::solve(unsigned maxIterations, float tolerance) {
+  unsigned n = m_mass.size();
+  m_dv.assign(n, Vec3f(0,0,0));
+  m_r.resize(n);
+  m_z.resize(n);
+  m_p.resize(n);
+  m_Ap.resize(n);
+
+  // Jacobi preconditioner from the diagonal of M + sum of S
+  m_invDiagonal.assign(n, Vec3f(0,0,0));
+  for (unsigned i = 0; i < n; i++)
+    m_invDiagonal[i] = Vec3f(m_mass[i], m_mass[i], m_mass[i]);
+  for (unsigned k = 0; k < m_blocks.size(); k++) {
+    Block const &block = m_blocks[k];
+    Vec3f diagonal = Vec3f(block.alpha, block.alpha, block.alpha) +
+                     block.beta * block.u.componentwiseMult(block.u);
+    if (block.a >= 0)
+      m_invDiagonal[block.a] += diagonal;
+    if (block.b >= 0)
+      m_invDiagonal[block.b] += diagonal;
+  }
+  for (unsigned i = 0; i < n; i++)
+    m_invDiagonal[i] = Vec3f(1 / m_invDiagonal[i].x(),
+                             1 / m_invDiagonal[i].y(),
+                             1 / m_invDiagonal[i].z());
+
+  // start from the explicit answer, dv = M^-1 * rhs
+  for (unsigned i = 0; i < n; i++)
+    m_dv[i] = m_rhs[i] / m_mass[i];
+
+  multiply(m_dv, m_Ap);
+  float rz = 0;
+  float rhsNorm = 0;
+  for (unsigned i = 0; i < n; i++) {
+    m_r[i] = m_rhs[i] - m_Ap[i];
+    m_z[i] = m_invDiagonal[i].componentwiseMult(m_r[i]);
+    m_p[i] = m_z[i];
+    rz += m_r[i] * m_z[i];
+    rhsNorm += m_rhs[i].lengthSquared();
+  }
+
+  float threshold = tolerance * tolerance * rhsNorm;
+  unsigned iteration = 0;
+  for (; iteration < maxIterations; iteration++) {
+    float rr = 0;
+    for (unsigned i = 0; i < n; i++)
+      rr += m_r[i].lengthSquared();
+    if (rr <= threshold)
+      break;
+
+    multiply(m_p, m_Ap);
+    float pAp = 0;
+    for (unsigned i = 0; i < n; i++)
+      pAp += m_p[i] * m_Ap[i];
+    if (pAp <= 0)
+      break;
+
+    float step = rz / pAp;
+    float rzNext = 0;
+    for (unsigned i = 0; i < n; i++) {
+      m_dv[i] += step * m_p[i];
+      m_r[i] -= step * m_Ap[i];
+      m_z[i] = m_invDiagonal[i].componentwiseMult(m_r[i]);
+      rzNext += m_r[i] * m_z[i];
+    }
+
+    float ratio = rzNext / rz;
+    rz = rzNext;
+    for (unsigned i = 0; i < n; i++)
+      m_p[i] = m_z[i] + ratio * m_p[i];
+  }
+
+  return iteration;
+}
@@ -0,0 +1,132 @@
+/**
+ * File:	MassPicker.cpp
+ */
+
+#include "MassPicker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+float const miss = std::numeric_limits<float>::max();
+
+} // namespace
+
+MassPicker::MassPicker() : m_radius(1), m_rebuildQuality(2), m_masses(0) {}
+
+void MassPicker::clear() {
+  m_masses = 0;
+  m_springs.clear();
+  m_boxes.clear();
+  m_bvh = Bvh();
+}
+
+void MassPicker::build(std::vector<Vec3f> const &positions,
+                       std::vector<unsigned> const &springs,
+                       ThreadPool &pool) {
+  m_masses = positions.size();
+  m_springs = springs;
+  fitBoxes(positions, pool);
+  m_bvh.build(m_boxes, pool);
+}
+
+void MassPicker::refit(std::vector<Vec3f> const &positions,
+                       ThreadPool &pool) {
+  fitBoxes(positions, pool);
+  m_bvh.refit(m_boxes, pool);
+  if (m_bvh.quality() > m_rebuildQuality)
+    m_bvh.build(m_boxes, pool);
+}
+
+void MassPicker::fitBoxes(std::vector<Vec3f> const &positions,
+                          ThreadPool &pool) {
+  unsigned masses = positions.size();
+  unsigned count = masses + m_springs.size() / 2;
+  m_boxes.resize(count);
+
+  unsigned chunks = std::max(1u, std::min(4 * pool.size(), count / 4096));
+  unsigned chunkSize = (count + chunks - 1) / chunks;
+  pool.parallelFor(chunks, [&](unsigned chunk) {
+    unsigned end = std::min(count, (chunk + 1) * chunkSize);
+    for (unsigned i = chunk * chunkSize; i < end; i++) {
+      if (i < masses) {
+        m_boxes[i] = Aabb::around(positions[i], m_radius);
+        continue;
+      }
+      unsigned const *ends = &m_springs[2 * (i - masses)];
+      Aabb box = Aabb::around(positions[ends[0]], m_radius);
+      box.grow(Aabb::around(positions[ends[1]], m_radius));
+      m_boxes[i] = box;
+    }
+  });
+}
+
+int MassPicker::pick(Vec3f const &origin, Vec3f const &direction,
+                     float &distance) const {
+  int picked = -1;
+  distance = m_bvh.raycast(
+      origin, direction, miss, [&](unsigned primitive, float limit) {
+        float t;
+        unsigned mass;
+        if (primitive < m_masses) {
+          t = hitSphere(origin, direction, primitive);
+          mass = primitive;
+        } else {
+          float along;
+          unsigned spring = primitive - m_masses;
+          t = hitCapsule(origin, direction, spring, along);
+          mass = m_springs[2 * spring + (along < 0.5f ? 0 : 1)];
+        }
+        if (t >= limit)
+          return limit;
+        picked = mass;
+        return t;
+      });
+  return picked;
+}
+
+// Where the ray enters the sphere around the mass, or where it starts if
+// that is inside.
+float MassPicker::hitSphere(Vec3f const &origin, Vec3f const &direction,
+                            unsigned mass) const {
+  Vec3f toCentre = position(mass) - origin;
+  float closest = toCentre * direction;
+  float offsetSq = toCentre.lengthSquared() - closest * closest;
+  float radiusSq = m_radius * m_radius;
+  if (offsetSq > radiusSq)
+    return miss;
+  float t = closest - std::sqrt(radiusSq - offsetSq);
+  if (t >= 0)
+    return t;
+  return toCentre.lengthSquared() <= radiusSq ? 0 : miss;
+}
+
+// The closest approach of the ray to the spring, pulled back to about where
+// the ray enters the capsule. along is the fraction of the way from the
+// first end to the second.
+float MassPicker::hitCapsule(Vec3f const &origin, Vec3f const &direction,
+                             unsigned spring, float &along) const {
+  Vec3f a = position(m_springs[2 * spring]);
+  Vec3f e = position(m_springs[2 * spring + 1]) - a;
+  Vec3f w = origin - a;
+  float de = direction * e, ee = e * e;
+  float dw = direction * w, ew = e * w;
+
+  float denom = ee - de * de;
+  along = denom > 1e-12f * ee ? (ew - dw * de) / denom : 0;
+  along = std::min(1.f, std::max(0.f, along));
+  float t = along * de - dw;
+  if (t < 0) {
+    t = 0;
+    along = ee > 0 ? std::min(1.f, std::max(0.f, ew / ee)) : 0;
+  }
+
+  Vec3f gap = w + t * direction - along * e;
+  float gapSq = gap.lengthSquared();
+  float radiusSq = m_radius * m_radius;
+  if (gapSq > radiusSq)
+    return miss;
+  return std::max(0.f, t - std::sqrt(radiusSq - gapSq));
+}
@@ -0,0 +1,88 @@
+/**
+ * File:	NeighbourList.cpp
+ */
+
+#include "NeighbourList.h"
+
+#include <algorithm>
+
+NeighbourList::NeighbourList()
+    : m_radius(0), m_skin(0), m_builds(0), m_offsets(1, 0) {}
+
+void NeighbourList::setRange(float radius, float skin) {
+  if (radius != m_radius || skin != m_skin)
+    m_reference.clear(); // forces a rebuild
+  m_radius = radius;
+  m_skin = skin;
+}
+
+bool NeighbourList::stale(std::vector<Vec3f> const &positions,
+                          float margin) const {
+  if (positions.size() != m_reference.size())
+    return true;
+
+  float limit = 0.5 * m_skin - margin;
+  if (limit <= 0)
+    return true;
+
+  float limitSq = limit * limit;
+  for (unsigned i = 0; i < positions.size(); i++) {
+    if ((positions[i] - m_reference[i]).lengthSquared() > limitSq)
+      return true;
+  }
+  return false;
+}
+
+void NeighbourList::build(std::vector<Vec3f> const &positions,
+                          ThreadPool &pool) {
+  unsigned count = positions.size();
+  m_reference = positions;
+  m_builds++;
+
+  m_grid.setCellSize(m_radius + m_skin);
+  m_grid.build(positions, pool);
+
+  // split the points into one contiguous chunk per thread, each with its own
+  // candidate scratch
+  unsigned chunks = std::max(1u, std::min(pool.size(), count / 256));
+  unsigned chunkSize = (count + chunks - 1) / chunks;
+  m_candidates.resize(chunks);
+
+  // count, scan, fill
+  m_offsets.assign(count + 1, 0);
+  pool.parallelFor(chunks, [&](unsigned chunk) {
+    std::vector<unsigned> &candidates = m_candidates[chunk];
+    unsigned end = std::min(count, (chunk + 1) * chunkSize);
+    for (unsigned i = chunk * chunkSize; i < end; i++) {
+      candidates.clear();
+      m_grid.gatherNeighbours(positions[i], candidates);
+      unsigned n = 0;
+      for (unsigned c = 0; c < candidates.size(); c++) {
+        unsigned j = candidates[c];
+        if (j != i && withinRange(positions[i], positions[j]))
+          n++;
+      }
+      m_offsets[i + 1] = n;
+    }
+  });
+
+  for (unsigned i = 0; i < count; i++)
+    m_offsets[i + 1] += m_offsets[i];
+  m_neighbours.resize(m_offsets[count]);
+
+  pool.parallelFor(chunks, [&](unsigned chunk) {
+    std::vector<unsigned> &candidates = m_candidates[chunk];
+    unsigned end = std::min(count, (chunk + 1) * chunkSize);
+    for (unsigned i = chunk * chunkSize; i < end; i++) {
+      candidates.clear();
+      m_grid.gatherNeighbours(positions[i], candidates);
+      unsigned *out = m_neighbours.data() + m_offsets[i];
+      for (unsigned c = 0; c < candidates.size(); c++) {
+        unsigned j = candidates[c];
+        if (j != i && withinRange(positions[i], positions[j]))
+          *out++ = j;
+      }
+      std::sort(m_neighbours.data() + m_offsets[i], out);
+    }
+  });
+}
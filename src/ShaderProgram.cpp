@@ -0,0 +1,102 @@
+/**
+ * File:	ShaderProgram.cpp
+ */
+
+#include "ShaderProgram.h"
+
+#include "ShaderTools.h"
+
+namespace {
+
+// by ShaderProgram::Uniform
+char const *const uniformNames[ShaderProgram::UNIFORM_COUNT] = {"inputColor",
+                                                                "scale"};
+
+} // namespace
+
+GLuint ShaderProgram::s_current = 0;
+
+ShaderProgram::ShaderProgram() : m_id(0) {
+  for (int u = 0; u < UNIFORM_COUNT; u++) {
+    m_locations[u] = -1;
+    m_set[u] = false;
+  }
+}
+
+bool ShaderProgram::create(std::string const &vsSource,
+                           std::string const &fsSource) {
+  return link(CreateShaderProgram(vsSource, fsSource));
+}
+
+bool ShaderProgram::create(std::string const &vsSource,
+                           std::string const &gsSource,
+                           std::string const &fsSource) {
+  return link(CreateShaderProgram(vsSource, gsSource, fsSource));
+}
+
+void ShaderProgram::destroy() {
+  if (s_current == m_id)
+    s_current = 0;
+  glDeleteProgram(m_id);
+  *this = ShaderProgram();
+}
+
+// Everything that only has to be asked of the program once.
+bool ShaderProgram::link(GLuint id) {
+  m_id = id;
+  if (m_id == 0)
+    return false;
+
+  for (int u = 0; u < UNIFORM_COUNT; u++) {
+    m_locations[u] = glGetUniformLocation(m_id, uniformNames[u]);
+    m_set[u] = false;
+  }
+
+  GLuint frame = glGetUniformBlockIndex(m_id, "Frame");
+  if (frame != GL_INVALID_INDEX)
+    glUniformBlockBinding(m_id, frame, FRAME_BINDING);
+  return true;
+}
+
+void ShaderProgram::set(Uniform uniform, float x) {
+  if (m_locations[uniform] < 0 ||
+      (m_set[uniform] && m_values[uniform][0] == x))
+    return;
+
+  use();
+  glUniform1f(m_locations[uniform], x);
+  m_values[uniform][0] = x;
+  m_set[uniform] = true;
+}
+
+void ShaderProgram::set(Uniform uniform, float x, float y, float z) {
+  float *value = m_values[uniform];
+  if (m_locations[uniform] < 0 ||
+      (m_set[uniform] && value[0] == x && value[1] == y && value[2] == z))
+    return;
+
+  use();
+  glUniform3f(m_locations[uniform], x, y, z);
+  value[0] = x;
+  value[1] = y;
+  value[2] = z;
+  m_set[uniform] = true;
+}
+
+Material::Material() : m_program(0), m_scale(1) {
+  m_color[0] = m_color[1] = m_color[2] = 0;
+}
+
+Material::Material(ShaderProgram *program, float r, float g, float b,
+                   float scale)
+    : m_program(program), m_scale(scale) {
+  m_color[0] = r;
+  m_color[1] = g;
+  m_color[2] = b;
+}
+
+void Material::apply() const {
+  m_program->use();
+  m_program->set(ShaderProgram::COLOR, m_color[0], m_color[1], m_color[2]);
+  m_program->set(ShaderProgram::SCALE, m_scale);
+}
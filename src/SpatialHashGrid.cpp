@@ -0,0 +1,98 @@
+/**
+ * File:	SpatialHashGrid.cpp
+ */
+
+#include "SpatialHashGrid.h"
+
+SpatialHashGrid::SpatialHashGrid()
+    : m_cellSize(1), m_invCellSize(1), m_mask(0), m_bucketStart(2, 0) {}
+
+void SpatialHashGrid::setCellSize(float size) {
+  m_cellSize = size;
+  m_invCellSize = 1 / size;
+}
+
+void SpatialHashGrid::build(std::vector<Vec3f> const &positions,
+                            ThreadPool &pool) {
+  unsigned count = positions.size();
+
+  // about two buckets per point keeps the chains short
+  unsigned buckets = 1;
+  while (buckets < 2 * count)
+    buckets *= 2;
+  m_mask = buckets - 1;
+
+  unsigned chunks = std::max(1u, std::min(pool.size(), count / 1024));
+  unsigned chunkSize = (count + chunks - 1) / std::max(1u, chunks);
+
+  m_bucketOfPoint.resize(count);
+  m_sorted.resize(count);
+  m_bucketStart.assign(buckets + 1, 0);
+  m_chunkCounts.assign(chunks * buckets, 0);
+
+  // histogram of every chunk
+  pool.parallelFor(chunks, [&](unsigned chunk) {
+    unsigned *counts = &m_chunkCounts[chunk * buckets];
+    unsigned end = std::min(count, (chunk + 1) * chunkSize);
+    for (unsigned i = chunk * chunkSize; i < end; i++) {
+      Vec3f const &p = positions[i];
+      unsigned bucket = bucketOf(cellCoordinate(p.x()), cellCoordinate(p.y()),
+                                 cellCoordinate(p.z()));
+      m_bucketOfPoint[i] = bucket;
+      counts[bucket]++;
+    }
+  });
+
+  // exclusive scan over (bucket, chunk) so every chunk scatters into its own
+  // slice of every bucket, which keeps the result independent of threading
+  unsigned offset = 0;
+  for (unsigned bucket = 0; bucket < buckets; bucket++) {
+    m_bucketStart[bucket] = offset;
+    for (unsigned chunk = 0; chunk < chunks; chunk++) {
+      unsigned &n = m_chunkCounts[chunk * buckets + bucket];
+      unsigned chunkCount = n;
+      n = offset;
+      offset += chunkCount;
+    }
+  }
+  m_bucketStart[buckets] = offset;
+
+  pool.parallelFor(chunks, [&](unsigned chunk) {
+    unsigned *next = &m_chunkCounts[chunk * buckets];
+    unsigned end = std::min(count, (chunk + 1) * chunkSize);
+    for (unsigned i = chunk * chunkSize; i < end; i++)
+      m_sorted[next[m_bucketOfPoint[i]]++] = i;
+  });
+}
+
+void SpatialHashGrid::gatherNeighbours(Vec3f const &p,
+                                       std::vector<unsigned> &out) const {
+  int cx = cellCoordinate(p.x());
+  int cy = cellCoordinate(p.y());
+  int cz = cellCoordinate(p.z());
+
+  // different cells can hash to the same bucket, only visit it once (empty
+  // buckets are skipped before that check, most of them are)
+  unsigned visited[27];
+  unsigned visitedCount = 0;
+
+  for (int dx = -1; dx <= 1; dx++) {
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dz = -1; dz <= 1; dz++) {
+        unsigned bucket = bucketOf(cx + dx, cy + dy, cz + dz);
+        if (m_bucketStart[bucket] == m_bucketStart[bucket + 1])
+          continue;
+
+        bool seen = false;
+        for (unsigned n = 0; n < visitedCount && !seen; n++)
+          seen = visited[n] == bucket;
+        if (seen)
+          continue;
+        visited[visitedCount++] = bucket;
+
+        out.insert(out.end(), m_sorted.begin() + m_bucketStart[bucket],
+                   m_sorted.begin() + m_bucketStart[bucket + 1]);
+      }
+    }
+  }
+}
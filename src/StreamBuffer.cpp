@@ -0,0 +1,160 @@
+/**
+ * File:	StreamBuffer.cpp
+ */
+
+#include "StreamBuffer.h"
+
+#include <cstring>
+
+// from ARB_buffer_storage, which the loader isn't generated with
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+namespace {
+
+typedef void(APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size,
+                                          const void *data, GLbitfield flags);
+
+BufferStorageProc bufferStorage = 0;
+
+bool hasExtension(char const *name) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    char const *extension =
+        reinterpret_cast<char const *>(glGetStringi(GL_EXTENSIONS, i));
+    if (extension && std::strcmp(extension, name) == 0)
+      return true;
+  }
+  return false;
+}
+
+} // namespace
+
+StreamBuffer::StreamBuffer(unsigned stride)
+    : m_stride(stride), m_id(0), m_capacity(0), m_region(REGIONS - 1),
+      m_mapped(0) {
+  for (unsigned r = 0; r < REGIONS; r++)
+    m_fences[r] = 0;
+}
+
+void StreamBuffer::setStride(unsigned stride) {
+  if (stride == m_stride)
+    return;
+  m_stride = stride;
+  m_capacity = 0;
+}
+
+bool StreamBuffer::loadPersistentMapping(GLADloadproc load) {
+  bufferStorage = 0;
+  bool core = GLVersion.major > 4 || (GLVersion.major == 4 &&
+                                      GLVersion.minor >= 4);
+  if (core || hasExtension("GL_ARB_buffer_storage"))
+    bufferStorage = reinterpret_cast<BufferStorageProc>(
+        load("glBufferStorage"));
+  return bufferStorage != 0;
+}
+
+bool StreamBuffer::persistent() { return bufferStorage != 0; }
+
+void StreamBuffer::create() {
+  glGenBuffers(1, &m_id);
+  m_capacity = 0;
+}
+
+void StreamBuffer::destroy() {
+  for (unsigned r = 0; r < REGIONS; r++) {
+    if (m_fences[r])
+      glDeleteSync(m_fences[r]);
+    m_fences[r] = 0;
+  }
+  // deleting a buffer unmaps it, and the draws still reading it finish first
+  glDeleteBuffers(1, &m_id);
+  m_id = 0;
+  m_mapped = 0;
+  m_capacity = 0;
+  m_staging.clear();
+}
+
+// Grows by half again, so a slowly growing scene doesn't reallocate often.
+// Storage for persistent mapping can't be resized, so that takes a new
+// buffer.
+bool StreamBuffer::reserve(unsigned vertices) {
+  if (vertices <= m_capacity && m_capacity > 0)
+    return false;
+
+  unsigned capacity = vertices + vertices / 2;
+  if (capacity < 64)
+    capacity = 64;
+
+  if (!persistent()) {
+    m_capacity = capacity;
+    m_staging.resize(std::size_t(capacity) * m_stride);
+    return false;
+  }
+
+  if (m_mapped) {
+    destroy();
+    create();
+  }
+  m_capacity = capacity;
+  m_region = REGIONS - 1;
+
+  GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                     GL_MAP_COHERENT_BIT;
+  GLsizeiptr size = GLsizeiptr(REGIONS) * capacity * m_stride;
+  glBindBuffer(GL_ARRAY_BUFFER, m_id);
+  bufferStorage(GL_ARRAY_BUFFER, size, 0, flags);
+  m_mapped = static_cast<char *>(
+      glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags));
+  return true;
+}
+
+void *StreamBuffer::map() {
+  if (!m_mapped)
+    return &m_staging[0];
+
+  m_region = (m_region + 1) % REGIONS;
+  waitRegion(m_region);
+  return m_mapped + std::size_t(m_region) * m_capacity * m_stride;
+}
+
+// A coherent mapping needs nothing more. Otherwise the old storage is
+// orphaned first, so the upload doesn't wait for the draws reading it.
+void StreamBuffer::unmap(unsigned vertices) {
+  if (m_mapped)
+    return;
+
+  glBindBuffer(GL_ARRAY_BUFFER, m_id);
+  glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(m_capacity) * m_stride, 0,
+               GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(vertices) * m_stride,
+                  &m_staging[0]);
+}
+
+void StreamBuffer::fence() {
+  if (!m_mapped)
+    return;
+
+  if (m_fences[m_region])
+    glDeleteSync(m_fences[m_region]);
+  m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void StreamBuffer::waitRegion(unsigned region) {
+  GLsync sync = m_fences[region];
+  if (!sync)
+    return;
+
+  GLenum status;
+  do {
+    status = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+  } while (status == GL_TIMEOUT_EXPIRED);
+
+  glDeleteSync(sync);
+  m_fences[region] = 0;
+}
@@ -0,0 +1,125 @@
+/**
+ * File:	SweepAndPrune.cpp
+ */
+
+#include "SweepAndPrune.h"
+
+#include <algorithm>
+
+namespace {
+
+// Order of the box ends along an axis. At equal values the start of a box
+// goes first, so boxes that just touch count as overlapping, the same as
+// Aabb::overlaps().
+template <class Endpoint> bool before(Endpoint const &x, Endpoint const &y) {
+  return x.value < y.value || (x.value == y.value && !x.max && y.max);
+}
+
+template <class Pair> bool pairLess(Pair const &x, Pair const &y) {
+  return x.a < y.a || (x.a == y.a && x.b < y.b);
+}
+
+} // namespace
+
+SweepAndPrune::SweepAndPrune() : m_swaps(0) {}
+
+void SweepAndPrune::clear() {
+  m_boxes.clear();
+  for (int axis = 0; axis < 3; axis++)
+    m_endpoints[axis].clear();
+  m_overlaps.clear();
+  m_pairs.clear();
+  m_swaps = 0;
+}
+
+void SweepAndPrune::update(std::vector<Aabb> const &boxes) {
+  bool resized = boxes.size() != m_boxes.size();
+  m_boxes = boxes;
+
+  if (resized) {
+    rebuild();
+  } else {
+    m_swaps = 0;
+    for (int axis = 0; axis < 3; axis++) {
+      std::vector<Endpoint> &ends = m_endpoints[axis];
+      for (unsigned n = 0; n < ends.size(); n++) {
+        Aabb const &box = m_boxes[ends[n].box];
+        ends[n].value = ends[n].max ? box.max[axis] : box.min[axis];
+      }
+      sortAxis(axis);
+    }
+  }
+
+  m_pairs.clear();
+  for (std::unordered_set<unsigned long long>::const_iterator it =
+           m_overlaps.begin();
+       it != m_overlaps.end(); ++it) {
+    Pair pair = {unsigned(*it >> 32), unsigned(*it & 0xffffffffu)};
+    m_pairs.push_back(pair);
+  }
+  std::sort(m_pairs.begin(), m_pairs.end(), pairLess<Pair>);
+}
+
+// Sorts every axis from scratch and finds the overlaps with one sweep along
+// x, testing each box against the ones open where it starts.
+void SweepAndPrune::rebuild() {
+  unsigned count = m_boxes.size();
+  for (int axis = 0; axis < 3; axis++) {
+    std::vector<Endpoint> &ends = m_endpoints[axis];
+    ends.resize(2 * count);
+    for (unsigned i = 0; i < count; i++) {
+      Endpoint start = {m_boxes[i].min[axis], i, false};
+      Endpoint end = {m_boxes[i].max[axis], i, true};
+      ends[2 * i] = start;
+      ends[2 * i + 1] = end;
+    }
+    std::sort(ends.begin(), ends.end(), before<Endpoint>);
+  }
+  m_swaps = 0;
+
+  m_overlaps.clear();
+  std::vector<unsigned> open;
+  std::vector<unsigned> openAt(count);
+  std::vector<Endpoint> const &ends = m_endpoints[0];
+  for (unsigned n = 0; n < ends.size(); n++) {
+    unsigned box = ends[n].box;
+    if (!ends[n].max) {
+      for (unsigned k = 0; k < open.size(); k++) {
+        if (overlap(box, open[k]))
+          m_overlaps.insert(key(box, open[k]));
+      }
+      openAt[box] = open.size();
+      open.push_back(box);
+    } else {
+      unsigned last = open.back();
+      open[openAt[box]] = last;
+      openAt[last] = openAt[box];
+      open.pop_back();
+    }
+  }
+}
+
+// Insertion sort of one axis. An end moving left past another end is the
+// only place the two boxes' extents on this axis can change from apart to
+// overlapping or back, so that is where pairs are added, if they overlap on
+// the other axes too, and removed.
+void SweepAndPrune::sortAxis(int axis) {
+  std::vector<Endpoint> &ends = m_endpoints[axis];
+  for (unsigned i = 1; i < ends.size(); i++) {
+    Endpoint moving = ends[i];
+    unsigned j = i;
+    while (j > 0 && before(moving, ends[j - 1])) {
+      Endpoint const &passed = ends[j - 1];
+      if (!moving.max && passed.max) {
+        if (overlap(moving.box, passed.box))
+          m_overlaps.insert(key(moving.box, passed.box));
+      } else if (moving.max && !passed.max) {
+        m_overlaps.erase(key(moving.box, passed.box));
+      }
+      ends[j] = passed;
+      j--;
+      m_swaps++;
+    }
+    ends[j] = moving;
+  }
+}
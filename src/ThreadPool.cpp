@@ -0,0 +1,93 @@
+/**
+ * File:	ThreadPool.cpp
+ */
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace {
+// set on pool workers and on a caller while it helps with a parallelFor
+thread_local bool t_insideTask = false;
+}
+
+ThreadPool::ThreadPool(unsigned threadCount)
+    : m_task(nullptr), m_count(0), m_next(0), m_busy(0), m_generation(0),
+      m_quit(false) {
+  if (threadCount == 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+  for (unsigned i = 1; i < threadCount; i++)
+    m_threads.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+
+  for (unsigned i = 0; i < m_threads.size(); i++)
+    m_threads[i].join();
+}
+
+unsigned ThreadPool::size() const { return m_threads.size() + 1; }
+
+void ThreadPool::parallelFor(unsigned count,
+                             std::function<void(unsigned)> const &task) {
+  if (count == 0)
+    return;
+
+  // nested or trivial loops aren't worth waking anybody for
+  if (t_insideTask || m_threads.empty() || count == 1) {
+    for (unsigned i = 0; i < count; i++)
+      task(i);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_task = &task;
+    m_count = count;
+    m_next = 0;
+    m_busy = m_threads.size();
+    m_generation++;
+  }
+  m_wake.notify_all();
+
+  t_insideTask = true;
+  runTasks();
+  t_insideTask = false;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done.wait(lock, [this] { return m_busy == 0; });
+  m_task = nullptr;
+}
+
+void ThreadPool::runTasks() {
+  unsigned i;
+  while ((i = m_next.fetch_add(1)) < m_count)
+    (*m_task)(i);
+}
+
+void ThreadPool::workerLoop() {
+  t_insideTask = true;
+  unsigned seen = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [&] { return m_quit || m_generation != seen; });
+      if (m_quit)
+        return;
+      seen = m_generation;
+    }
+
+    runTasks();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_busy == 0)
+      m_done.notify_one();
+  }
+}
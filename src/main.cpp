@@ -26,10 +26,16 @@
  */
 
 #include <iostream>
+#include <atomic>
 #include <cmath>
 #include <chrono>
+#include <cstdio>
 #include <limits>
 #include <cstdlib>
+#include <cstring>
+#include <string>
+#include <mutex>
+#include <thread>
 
 #include "glad/glad.h"
 #include <GLFW/glfw3.h>
@@ -39,33 +45,93 @@
 #include "Mat4f.h"
 #include "OpenGLMatrixTools.h"
 #include "Camera.h"
+#include "ClothCollision.h"
+#include "Collider.h"
+#include "HeadlessContext.h"
+#include "ImexSolver.h"
+#include "MassPicker.h"
+#include "StreamBuffer.h"
+#include "GpuTimer.h"
+#include "ShaderProgram.h"
+#include "NeighbourList.h"
+#include "SweepAndPrune.h"
+#include "ThreadPool.h"
+#include "TripleBuffer.h"
+#include "UnionFind.h"
 
 //==================== GLOBAL VARIABLES ====================//
 /*	Put here for simplicity. Feel free to restructure into
 *	appropriate classes or abstractions.
 */
 
-// Drawing Program
-GLuint basicProgramID;
-
-// Data needed for Quad
+// Drawing Programs, and the materials things are drawn with
+ShaderProgram basicProgram;
+ShaderProgram billboardProgram;  // masses as points, grown in a geometry shader
+ShaderProgram surfaceProgram;    // the cloth lattice as a lit surface
+Material massMaterial;
+Material springMaterial;
+Material billboardMaterial;
+Material surfaceMaterial;
+
+// The Frame block of the shaders, filled once a frame: the camera, how the
+// positions of this frame are to be decoded, and where the cloth lattice's
+// are. Row major, the vectors padded to four floats.
+struct FrameBlock {
+  float V[16], P[16], VP[16];
+  float cameraRight[4], cameraUp[4], cameraForward[4];
+  float positionOrigin[4], positionScale[4];
+  GLint lattice[4];   // length, width, first position in the mass buffer
+};
+GLuint frameBufferID;
+
+// With quantizedPositions on (P), the positions go to the GPU as three
+// normalized 16 bit coordinates in the box around every island, half the
+// size of three floats. The shaders turn them back with positionOrigin and
+// positionScale, which are 0 and 1 when the positions are floats.
+bool quantizedPositions = false;
+Vec3f positionOrigin(0, 0, 0);
+Vec3f positionScale(1, 1, 1);
+Vec3f positionInverse;  // the other way, into 0 to 65535
+
+// Data needed for Quad: one unit quad, drawn once per mass
 GLuint vaoID;
 GLuint vertBufferID;
-Mat4f M;
+StreamBuffer massBuffer(sizeof(Vec3f));
+
+// The same masses drawn as points for billboardProgram
+GLuint point_vaoID;
+
+// How the masses are drawn, switched with B. Either way their drawing is
+// timed on the GPU and reported every timerReportPeriod seconds.
+enum MassRender { INSTANCED_QUADS, BILLBOARDS };
+MassRender massRender = INSTANCED_QUADS;
+GpuTimer massTimer;
+double timerReportPeriod = 2;
+double lastTimerReport = 0;
 
 // Data needed for Line
+// Springs as pairs of indices into the mass positions, set once a scene
 GLuint line_vaoID;
-GLuint line_vertBufferID;
-Mat4f line_M;
+GLuint line_indexBufferID;
+
+// The cloth lattice as triangles, drawn in place of its masses and springs
+// when clothSurface is on (F). The triangles are set once a scene. The
+// vertex shader reads the lattice positions from the mass buffer through a
+// texture buffer, and its normals from their neighbours', so the surface
+// costs the upload nothing.
+bool clothSurface = false;
+GLuint surface_vaoID;
+GLuint surface_indexBufferID;
+GLuint surface_positionTextureID;
+unsigned surfaceIndexCount = 0;
+
+// masses uploaded a task, by loadQuadGeometryToGPU
+unsigned uploadChunk = 16384;
 
 // Only one camera so only one veiw and perspective matrix are needed.
 Mat4f V;
 Mat4f P;
 
-// Only one thing is rendered at a time, so only need one MVP
-// When drawing different objects, update M and MVP = M * V * P
-Mat4f MVP;
-
 // Camera and veiwing Stuff
 Camera camera;
 int g_moveUpDown = 0;
@@ -79,7 +145,7 @@ float g_panningSpeed = 0.25;
 bool g_cursorLocked;
 float g_cursorX, g_cursorY;
 
-bool g_play = false;
+std::atomic<bool> g_play(false);
 
 int WIN_WIDTH = 1024, WIN_HEIGHT = 1024;
 int FB_WIDTH = 1024, FB_HEIGHT = 1024;
@@ -93,9 +159,15 @@ float e = 2.7182818f;
 Vec3f g = Vec3f(0,-9.81,0);
 
 int view = 1;
-bool replay = false;
 float ground = -50;
+float tableHeight = -30;    // view 5's table, a thin slab topped at this
+float tableWidth = 50;      // height over x in [25, 50] and z in [-50, -25]
+float tableThickness = 0.1;
 float masswidth = 0.25;
+float collisionRadius = 0.005;  // half the side of the mass collision box
+float neighbourSkin = 0.1;      // smallest margin the neighbour lists get
+unsigned massContactChunk = 256;  // active masses per resolveMassContacts task
+float airDamping = 0.1;  // set per view, most damping is in the springs now
 
 Vec3f wind = Vec3f(0,0,0);
 bool increaseX = false;
@@ -110,10 +182,17 @@ void init();
 void generateIDs();
 void deleteIDs();
 void setupVAO();
+void setupMassAttribute();
+void loadUnitQuadToGPU();
 void loadQuadGeometryToGPU();
+void loadLineGeometryToGPU();
+void loadDragSpringToGPU();
+void loadSurfaceGeometryToGPU();
+void loadFrameToGPU();
+void pointAtPositions(GLuint attribute, unsigned first);
+bool drawSurface();
 void reloadProjectionMatrix();
 void loadModelViewMatrix();
-void setupModelViewProjectionTransform();
 
 void windowSetSizeFunc();
 void windowKeyFunc(GLFWwindow *window, int key, int scancode, int action,
@@ -126,10 +205,23 @@ void windowMouseButtonFunc(GLFWwindow *window, int button, int action,
 void windowMouseMotionFunc(GLFWwindow *window, double x, double y);
 void windowKeyFunc(GLFWwindow *window, int key, int scancode, int action,
                    int mods);
+void setupPoints();
 void animatePoints(float t);
+void simulationLoop();
+void publishFrame();
+void restartScene(int nextView);
+bool acquireFrame();
+void updateFrameBlend();
+double wallSeconds();
+void placeCamera();
+bool parseArguments(int argc, char **argv);
+int runHeadless();
 void moveCamera();
-void reloadMVPUniform();
-void reloadColorUniform(float r, float g, float b);
+void buildPicker();
+void refitPicker(std::vector<Vec3f> const &positions);
+bool startDrag();
+void updateDragTarget();
+void reportMassTimer();
 std::string GL_ERROR();
 int main(int, char **);
 
@@ -141,6 +233,7 @@ struct Mass {
   Vec3f velocity;
   Vec3f force;
   bool fixed;
+  bool asleep;
 };
 
 struct Spring {
@@ -154,6 +247,194 @@ std::vector<Mass> points;
 std::vector<Spring> springs;
 std::vector<Vec3f> tempPoints;
 
+// Islands: connected components of the spring network. buildIslands()
+// reorders the masses and springs so every island owns a contiguous run of
+// each. Islands share no state, so animatePoints steps them in parallel, each
+// with its own substep and its own sleep state.
+struct Island {
+  unsigned massBegin, massEnd;      // points [massBegin, massEnd)
+  unsigned springBegin, springEnd;  // springs [springBegin, springEnd)
+  float maxDt;                      // largest stable substep
+  float maxDtImex;                  // same with the stiff springs implicit
+  float dt;                         // substep used in the last frame
+
+  std::vector<unsigned> regions;
+  std::vector<unsigned> activeMasses;
+  std::vector<unsigned> activeSprings;
+  std::vector<unsigned> boundarySprings;  // one endpoint asleep, one awake
+  bool activeSetsDirty;
+
+  // IMEX: awake springs stiff enough to be implicit, and the masses they
+  // touch, numbered as unknowns of the implicit solve
+  std::vector<unsigned> activeStiffSprings;
+  std::vector<unsigned> imexMasses;
+  std::vector<int> imexIndex;       // per island mass, -1 if not an unknown
+  ImexSolver imex;
+
+  // resolveMassContacts() candidates, rebuilt when the masses have moved
+  // too far
+  NeighbourList neighbours;
+  std::vector<Vec3f> positions;     // scratch copy of the island's positions
+
+  // triangles and hierarchy of the lattice cloths, empty otherwise
+  ClothCollision cloth;
+  float clothTravel;                // furthest any mass went since the pass
+  std::vector<Vec3f> stepStart;     // positions at the start of the substep
+
+  // the active masses in collider pass layout
+  ColliderBatch obstacles;
+
+  // per active mass, the velocity change its mass contacts ask for, and per
+  // chunk of them, the masses that have one and the sleepers they hit
+  std::vector<Vec3f> contactDeltas;
+  std::vector<std::vector<unsigned> > contactHits;
+  std::vector<std::vector<unsigned> > contactSleepers;
+
+  // around every mass, grown by half the object contact distance
+  Aabb bounds;
+};
+
+// Sleeping: the masses of an island are grouped into regions, square tiles of
+// the lattice on the cloths and runs of consecutive masses otherwise. A region
+// goes to sleep once its kinetic energy has stayed under the threshold for
+// sleepSteps substeps, and only the active masses and springs are stepped.
+struct Region {
+  std::vector<unsigned> masses;
+  unsigned island;
+  float kineticEnergy;    // accumulated by updatePoints every substep
+  int quietSteps;         // substeps spent under the threshold
+  bool asleep;
+};
+
+std::vector<Island> islands;
+std::vector<Region> regions;
+std::vector<unsigned> massRegion;       // region of each mass
+
+// The simulation thread's pool, and a smaller one of the render thread's
+// own for its passes over every mass, so neither waits for the other's
+// workers. Together they have one thread per hardware thread.
+unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+unsigned renderThreads = std::max(1u, hardwareThreads / 4);
+ThreadPool threadPool(std::max(1u, hardwareThreads - renderThreads));
+ThreadPool renderPool(renderThreads);
+
+// cloth lattice dimensions, 0 when the scene isn't a lattice
+unsigned latticeLength = 0;
+unsigned latticeWidth = 0;
+
+unsigned regionTile = 5;        // tile edge on lattices
+unsigned massesPerRegion = 25;  // run length otherwise
+float sleepEnergy = 0.000001;   // mean kinetic energy per mass to fall asleep
+float wakeEnergy = 0.000004;    // kinetic energy of a neighbour that wakes us
+int sleepSteps = 60;
+float stabilitySafety = 0.5;    // fraction of the explicit step limit to use
+
+// Semi-implicit Euler integrates everything explicitly. IMEX moves the
+// springs at or above imexStiffness into an implicit solve, so the soft
+// springs alone limit the substep.
+enum Integrator { SEMI_IMPLICIT_EULER, IMEX };
+Integrator integrator = SEMI_IMPLICIT_EULER;
+float imexStiffness = 48;       // the structural cloth springs, not the shear
+unsigned imexIterations = 20;
+float imexTolerance = 0.001;
+
+// Cloth self-collision: triangles closer than the thickness push apart. The
+// lattice spacing is 2, so untouched cloth stays well clear of it.
+// Pairs up to clothContactSkin further apart are cached between the full
+// passes, and only retested once they have moved clothContactTolerance
+// relative to each other.
+float clothThickness = 0.5;
+float clothContactSkin = 0.1;
+float clothContactTolerance = 0.05;
+int impactRounds = 4;           // of continuous response before freezing
+
+// Static obstacles of the scene, run over the moved masses after every
+// substep. The ground bounces masses back at half speed until they settle
+// on it; the table stops whatever lands on it.
+ColliderSet colliders;
+ColliderMaterial groundMaterial = {0.5, 0.5, 1, 1};
+ColliderMaterial tableMaterial = {0, 0, 0, 1};
+
+// Contact between islands: after every step, sweep and prune over the
+// island boxes finds the islands close enough to touch, and their masses
+// closer than objectContactDistance are pushed apart. The islands only meet
+// between steps, so with more than one a long frame is cut into steps of at
+// most objectContactStep. The distance is past half the diagonal of a jelly
+// cube face cell, so no mass fits through a face between its corners.
+SweepAndPrune objectPairs;
+std::vector<Aabb> objectBoxes;
+float objectContactDistance = 4;
+float objectFriction = 0.5;
+float objectWakeSpeed = 1;      // that a sleeping mass has to be hit with
+float objectContactStep = 0.02;
+
+// Dragging: a left click that lands on a mass or spring grabs the nearest
+// mass and pulls it towards the cursor ray, at the distance it was grabbed
+// at, with a zero length spring. A click anywhere else turns the camera.
+// Two pickers take turns, so a click never waits on a refit: the simulation
+// thread refits the spare one to every frame it publishes and swaps it in,
+// and a click picks with the current one, both under pickerMutex. They are
+// built with the scene, from its first frame. dragMass and dragTarget belong
+// to the render thread, which changes them under dragTargetMutex.
+MassPicker pickers[2];
+unsigned currentPicker = 0;
+bool pickersBuilt = false;      // for the scene as it is
+std::mutex pickerMutex;
+float pickRadius = 0.5;         // of the masses and springs under the cursor
+int dragMass = -1;
+float dragDistance;             // along the cursor ray
+Vec3f dragTarget;
+bool dragTargetMoved = false;   // since the masses were last uploaded
+float dragStiffness = 200;      // per unit mass, so every mass follows alike
+float dragDamping = 10;
+unsigned lineIndexCount = 0;    // in the line index buffer
+
+// The simulation runs on its own thread, simulationRate frames a second
+// while playing, and publishes every finished frame through a triple buffer.
+// The render loop draws the latest one it has without waiting on a step.
+// Whoever changes the scene or the simulation's state from outside (the
+// event callbacks) holds simulationMutex, which the simulation holds for the
+// whole of each frame; then it may also publish. The dragged mass and its
+// target change with every click and cursor event, so they go over on their
+// own, under dragTargetMutex, to be picked up at the start of the next frame.
+struct SimulationFrame {
+  std::vector<Vec3f> positions;   // of every mass
+  Aabb bounds;                    // around every mass
+  double time;                    // by wallSeconds(), when it was finished
+};
+TripleBuffer<SimulationFrame> simulationFrames;
+std::thread simulationThread;
+std::mutex simulationMutex;
+std::atomic<bool> simulationQuit(false);
+std::atomic<float> simulationRate(60);  // halved and doubled with - and =
+// Every frame steps the scene on by the same time, in ten substeps of
+// frameStep (or more, for an island whose springs need them), so at 60
+// frames a second the scene runs in real time and no frame costs more than
+// the one before it.
+float frameStep = 1 / 600.f;
+std::mutex dragTargetMutex;
+int simulationDragMass = -1;    // the simulation's copy of dragMass
+Vec3f simulationDragTarget;     // and of dragTarget
+
+// The simulation frames don't line up with the displayed ones, so the
+// renderer keeps the frame before the latest too, and draws the masses
+// where they were between the two. It runs one simulation frame behind:
+// the time since the latest came, as a fraction of the time between the
+// two, is how far from the earlier towards the latest (frameBlend) they are
+// drawn, which reaches the latest as the next is due.
+SimulationFrame previousFrame;
+float frameBlend = 1;
+
+// Run with --headless, there is no window: the scene of the view given is
+// played from the start into an offscreen framebuffer, one simulation frame
+// to each frame drawn, every frame written to <headlessPrefix>NNNN.ppm if a
+// prefix is given, and the frames a second reported at the end.
+bool headless = false;
+int headlessWidth = 1024, headlessHeight = 1024;
+int headlessFrames = 300;
+int headlessSamples = 4;
+std::string headlessPrefix;
+
 float length(Vec3f A, Vec3f B) {
   float x = A.x() - B.x();
   float y = A.y() - B.y();
@@ -162,34 +443,324 @@ float length(Vec3f A, Vec3f B) {
   return sqrt(x*x + y*y + z*z);
 }
 
+unsigned massIndex(Mass const *m) { return m - &points[0]; }
+
+unsigned regionOf(unsigned i) { return massRegion[i]; }
+
+// Largest substep semi-implicit Euler stays stable with, from Gershgorin
+// bounds on the highest spring frequency and the strongest damping of the
+// island. With skipStiff the springs IMEX handles implicitly don't count.
+float stableTimestep(Island const &island, bool skipStiff) {
+  std::vector<float> stiffness(island.massEnd - island.massBegin, 0);
+  std::vector<float> damping(island.massEnd - island.massBegin, airDamping);
+  for (unsigned i = island.springBegin; i < island.springEnd; i++) {
+    if (skipStiff && springs[i].stiffness >= imexStiffness)
+      continue;
+    unsigned a = massIndex(springs[i].a) - island.massBegin;
+    unsigned b = massIndex(springs[i].b) - island.massBegin;
+    stiffness[a] += springs[i].stiffness;
+    stiffness[b] += springs[i].stiffness;
+    damping[a] += 2 * springs[i].damping;
+    damping[b] += 2 * springs[i].damping;
+  }
+
+  float maxDt = std::numeric_limits<float>::max();
+  for (unsigned i = island.massBegin; i < island.massEnd; i++) {
+    if (points[i].fixed || points[i].mass <= 0)
+      continue;
+    float omegaSq = 2 * stiffness[i - island.massBegin] / points[i].mass;
+    if (omegaSq > 0)
+      maxDt = std::min(maxDt, 2 / std::sqrt(omegaSq));
+    float decay = damping[i - island.massBegin] / points[i].mass;
+    if (decay > 0)
+      maxDt = std::min(maxDt, 2 / decay);
+  }
+
+  if (maxDt == std::numeric_limits<float>::max())
+    return maxDt;
+  return stabilitySafety * maxDt;
+}
+
+// The box the broadphase between islands uses, and the one the positions
+// are quantized in.
+void fitIslandBounds(Island &island) {
+  island.bounds = Aabb::empty();
+  for (unsigned i = island.massBegin; i < island.massEnd; i++)
+    island.bounds.grow(points[i].position);
+  island.bounds.inflate(0.5 * objectContactDistance);
+}
+
+void buildIslands() {
+  islands.clear();
+
+  UnionFind sets(points.size());
+  for (unsigned i = 0; i < springs.size(); i++)
+    sets.unite(massIndex(springs[i].a), massIndex(springs[i].b));
+
+  // number the islands in order of their first mass
+  std::vector<unsigned> islandOfRoot(points.size(), ~0u);
+  std::vector<unsigned> massIsland(points.size());
+  for (unsigned i = 0; i < points.size(); i++) {
+    unsigned root = sets.find(i);
+    if (islandOfRoot[root] == ~0u) {
+      islandOfRoot[root] = islands.size();
+      islands.push_back(Island());
+    }
+    massIsland[i] = islandOfRoot[root];
+  }
+
+  // counting sort of the masses by island, stable so a single island (the
+  // lattices) keeps its order
+  std::vector<unsigned> massStart(islands.size() + 1, 0);
+  for (unsigned i = 0; i < points.size(); i++)
+    massStart[massIsland[i] + 1]++;
+  for (unsigned n = 0; n < islands.size(); n++)
+    massStart[n + 1] += massStart[n];
+
+  std::vector<unsigned> newIndex(points.size());
+  std::vector<unsigned> next(massStart.begin(), massStart.end() - 1);
+  for (unsigned i = 0; i < points.size(); i++)
+    newIndex[i] = next[massIsland[i]]++;
+
+  std::vector<Mass> sortedPoints(points.size());
+  for (unsigned i = 0; i < points.size(); i++)
+    sortedPoints[newIndex[i]] = points[i];
+
+  // same for the springs, remapping their endpoints into the new order
+  std::vector<unsigned> springStart(islands.size() + 1, 0);
+  for (unsigned i = 0; i < springs.size(); i++)
+    springStart[massIsland[massIndex(springs[i].a)] + 1]++;
+  for (unsigned n = 0; n < islands.size(); n++)
+    springStart[n + 1] += springStart[n];
+
+  std::vector<Spring> sortedSprings(springs.size());
+  next.assign(springStart.begin(), springStart.end() - 1);
+  for (unsigned i = 0; i < springs.size(); i++) {
+    unsigned a = massIndex(springs[i].a);
+    unsigned b = massIndex(springs[i].b);
+    Spring s = springs[i];
+    s.a = &points[newIndex[a]];
+    s.b = &points[newIndex[b]];
+    sortedSprings[next[massIsland[a]]++] = s;
+  }
+
+  // the spring pointers already point at the new slots in points
+  std::copy(sortedPoints.begin(), sortedPoints.end(), points.begin());
+  springs.swap(sortedSprings);
+
+  for (unsigned n = 0; n < islands.size(); n++) {
+    Island &island = islands[n];
+    island.massBegin = massStart[n];
+    island.massEnd = massStart[n + 1];
+    island.springBegin = springStart[n];
+    island.springEnd = springStart[n + 1];
+    island.maxDt = stableTimestep(island, false);
+    island.maxDtImex = stableTimestep(island, true);
+    island.dt = 0;
+    island.clothTravel = 0;
+    fitIslandBounds(island);
+  }
+}
+
+void resetSleepStates() {
+  regions.clear();
+  massRegion.assign(points.size(), 0);
+
+  for (unsigned n = 0; n < islands.size(); n++) {
+    Island &island = islands[n];
+    island.regions.clear();
+    unsigned first = regions.size();
+
+    // the lattices are a single island, so their indices are still row major
+    if (latticeLength > 0 && latticeWidth > 0) {
+      unsigned tilesAlong = (latticeLength + regionTile - 1) / regionTile;
+      unsigned tilesDown = (latticeWidth + regionTile - 1) / regionTile;
+      regions.resize(first + tilesAlong * tilesDown);
+      for (unsigned i = island.massBegin; i < island.massEnd; i++) {
+        unsigned row = i / latticeLength;
+        unsigned column = i % latticeLength;
+        massRegion[i] =
+            first + (row / regionTile) * tilesAlong + column / regionTile;
+      }
+    } else {
+      unsigned count = island.massEnd - island.massBegin;
+      regions.resize(first + (count + massesPerRegion - 1) / massesPerRegion);
+      for (unsigned i = island.massBegin; i < island.massEnd; i++)
+        massRegion[i] = first + (i - island.massBegin) / massesPerRegion;
+    }
+
+    for (unsigned r = first; r < regions.size(); r++) {
+      island.regions.push_back(r);
+      regions[r].island = n;
+    }
+    island.activeSetsDirty = true;
+  }
+
+  for (unsigned r = 0; r < regions.size(); r++) {
+    regions[r].masses.clear();
+    regions[r].kineticEnergy = 0;
+    regions[r].quietSteps = 0;
+    regions[r].asleep = false;
+  }
+  for (unsigned i = 0; i < points.size(); i++) {
+    regions[massRegion[i]].masses.push_back(i);
+    points[i].asleep = false;
+  }
+}
+
+void wakeRegion(unsigned r) {
+  if (!regions[r].asleep)
+    return;
+
+  regions[r].asleep = false;
+  regions[r].quietSteps = 0;
+  for (unsigned n = 0; n < regions[r].masses.size(); n++)
+    points[regions[r].masses[n]].asleep = false;
+
+  islands[regions[r].island].activeSetsDirty = true;
+}
+
+void sleepRegion(unsigned r) {
+  regions[r].asleep = true;
+  for (unsigned n = 0; n < regions[r].masses.size(); n++) {
+    unsigned i = regions[r].masses[n];
+    points[i].asleep = true;
+    points[i].velocity = Vec3f(0,0,0);
+    points[i].force = Vec3f(0,0,0);
+  }
+
+  islands[regions[r].island].activeSetsDirty = true;
+}
+
+void rebuildActiveSets(Island &island) {
+  island.activeMasses.clear();
+  island.activeSprings.clear();
+  island.boundarySprings.clear();
+
+  for (unsigned n = 0; n < island.regions.size(); n++) {
+    Region &region = regions[island.regions[n]];
+    if (region.asleep)
+      continue;
+    island.activeMasses.insert(island.activeMasses.end(),
+                               region.masses.begin(), region.masses.end());
+  }
+
+  for (unsigned i = island.springBegin; i < island.springEnd; i++) {
+    bool aAsleep = springs[i].a->asleep;
+    bool bAsleep = springs[i].b->asleep;
+    if (!aAsleep || !bAsleep)
+      island.activeSprings.push_back(i);
+    if (aAsleep != bAsleep)
+      island.boundarySprings.push_back(i);
+  }
+
+  island.activeStiffSprings.clear();
+  island.imexMasses.clear();
+  island.imexIndex.assign(island.massEnd - island.massBegin, -1);
+  if (integrator == IMEX) {
+    for (unsigned n = 0; n < island.activeSprings.size(); n++) {
+      Spring &s = springs[island.activeSprings[n]];
+      if (s.stiffness < imexStiffness)
+        continue;
+      island.activeStiffSprings.push_back(island.activeSprings[n]);
+
+      Mass *ends[2] = {s.a, s.b};
+      for (int e = 0; e < 2; e++) {
+        unsigned i = massIndex(ends[e]);
+        int &local = island.imexIndex[i - island.massBegin];
+        if (local < 0 && !ends[e]->fixed && !ends[e]->asleep) {
+          local = island.imexMasses.size();
+          island.imexMasses.push_back(i);
+        }
+      }
+    }
+  }
+
+  island.activeSetsDirty = false;
+}
+
+// Called after every substep, once updatePoints has filled in the kinetic
+// energy of the awake regions.
+void updateSleepStates(Island &island) {
+  // wake sleeping regions that a moving neighbour is pulling on
+  for (unsigned n = 0; n < island.boundarySprings.size(); n++) {
+    Spring &s = springs[island.boundarySprings[n]];
+    Mass *sleeper = s.a->asleep ? s.a : s.b;
+    Mass *mover = s.a->asleep ? s.b : s.a;
+    if (sleeper->fixed)
+      continue;
+    if (0.5 * mover->mass * mover->velocity.lengthSquared() > wakeEnergy)
+      wakeRegion(regionOf(massIndex(sleeper)));
+  }
+
+  for (unsigned n = 0; n < island.regions.size(); n++) {
+    Region &region = regions[island.regions[n]];
+    if (region.asleep)
+      continue;
+
+    if (region.kineticEnergy < sleepEnergy * region.masses.size())
+      region.quietSteps++;
+    else
+      region.quietSteps = 0;
+    region.kineticEnergy = 0;
+
+    if (region.quietSteps >= sleepSteps)
+      sleepRegion(island.regions[n]);
+  }
+}
+
 void displayFunc() {
+  unsigned massCount = simulationFrames.front().positions.size();
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  // Use our shader
-  glUseProgram(basicProgramID);
+  // The camera, for every program at once
+  loadFrameToGPU();
 
   // ===== DRAW QUAD ====== //
-  MVP = P * V * M;
-  reloadMVPUniform();
-  reloadColorUniform(0.5, 0, 1);
-
-  // Use VAO that holds buffer bindings
-  // and attribute config of buffers
-  glBindVertexArray(vaoID);
-  // Draw Quads, start at vertex 0, draw 4 of them (for a quad)
-  glDrawArrays(GL_TRIANGLES, 0, 6 * points.size());
+  massTimer.begin();
+  if (drawSurface()) {
+    surfaceMaterial.apply();
+
+    glBindVertexArray(surface_vaoID);
+    glBindTexture(GL_TEXTURE_BUFFER, surface_positionTextureID);
+    glDrawElements(GL_TRIANGLES, surfaceIndexCount, GL_UNSIGNED_INT,
+                   (void *)0);
+  } else if (massRender == BILLBOARDS) {
+    billboardMaterial.apply();
+
+    // One point per mass, grown into a quad facing the camera
+    glBindVertexArray(point_vaoID);
+    glDrawArrays(GL_POINTS, massBuffer.first(), massCount);
+  } else {
+    massMaterial.apply();
+
+    // Use VAO that holds buffer bindings
+    // and attribute config of buffers
+    glBindVertexArray(vaoID);
+    setupMassAttribute();
+    // Draw Quads, 6 vertices (two triangles) for each mass
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, massCount);
+  }
+  massTimer.end();
 
   // ==== DRAW LINE ===== //
-  MVP = P * V * line_M;
-  reloadMVPUniform();
-
-  reloadColorUniform(0.2, 0.2, 0.2);
+  springMaterial.apply();
 
   // Use VAO that holds buffer bindings
   // and attribute config of buffers
   glBindVertexArray(line_vaoID);
   // Draw lines
-  glDrawArrays(GL_LINES, 0, 2 * springs.size());
+  if (!drawSurface()) {
+    glDrawElementsBaseVertex(GL_LINES, lineIndexCount, GL_UNSIGNED_INT,
+                             (void *)0, massBuffer.first());
+  } else if (dragMass >= 0) {
+    // the springs are behind the surface, but the drag spring, last, isn't
+    glDrawElementsBaseVertex(GL_LINES, 2, GL_UNSIGNED_INT,
+                             (void *)(sizeof(GLuint) * (lineIndexCount - 2)),
+                             massBuffer.first());
+  }
+
+  massBuffer.fence();
 
 }
 
@@ -199,42 +770,133 @@ void calculateSprings(int i, float dt){
   Vec3f b = (springs[i].b)->position;
   float Xo = springs[i].restLength;
   float k = springs[i].stiffness;
+  float c = springs[i].damping;
 
   float currentLength = length(b,a);
+  if (currentLength == 0)   // crushed flat, no direction to push along
+    return;
   Vec3f abUnit = (b-a)/currentLength;
 
+  // damping only acts along the spring, on the rate the endpoints separate
+  // at, so it doesn't slow down rigid motion like the air damping does
+  Vec3f relativeVelocity = (springs[i].b)->velocity - (springs[i].a)->velocity;
+  float stretchRate = relativeVelocity * abUnit;
+
   if (DEBUG == true)
     printf("currentLength = %f \n", currentLength);
-  Vec3f Fs = -k * (currentLength-Xo) * abUnit;
+  Vec3f Fs = (-k * (currentLength-Xo) - c * stretchRate) * abUnit;
 
-  (springs[i].a)->force += -Fs;
-  (springs[i].b)->force += Fs;
+  // sleeping masses are held in place, so they don't collect forces
+  if (!(springs[i].a)->asleep)
+    (springs[i].a)->force += -Fs;
+  if (!(springs[i].b)->asleep)
+    (springs[i].b)->force += Fs;
+
+
+}
 
+// Keeps the island's neighbour lists valid for the coming substep. A mass
+// moves up to about maxSpeed * dt during it, so that counts against the skin
+// too. Rebuilt lists get a skin wide enough to last the rest of the frame at
+// the current speeds.
+void updateNeighbourLists(Island &island, float dt, int substepsLeft) {
+  island.positions.resize(island.massEnd - island.massBegin);
+  float maxSpeedSq = 0;
+  for (unsigned i = island.massBegin; i < island.massEnd; i++) {
+    island.positions[i - island.massBegin] = points[i].position;
+    maxSpeedSq = std::max(maxSpeedSq, points[i].velocity.lengthSquared());
+  }
 
+  float maxSpeed = std::sqrt(maxSpeedSq);
+  if (island.neighbours.stale(island.positions, 2 * maxSpeed * dt)) {
+    float skin = 2.5 * maxSpeed * dt * substepsLeft;
+    island.neighbours.setRange(collisionRadius, std::max(neighbourSkin, skin));
+    island.neighbours.build(island.positions, threadPool);
+  }
 }
 
-int collision(unsigned int i, Vec3f xtdt){
-  float min = -0.005;
-  float max = 0.005;
-  Vec3f diff;
-  for (unsigned j = 0; j < points.size(); j++) {
-    if (j != i) {
-      diff = xtdt - points[j].position;
-      if ((diff.x() < max && diff.x() > min) && (diff.y() < max && diff.y() > min) && (diff.z() < max && diff.z() > min)) {
-        return j;
+// Contact between the masses of an island, after updatePoints has moved all
+// of them. Two masses touch when their new positions are within the
+// collision box of each other, and the contact is perfectly inelastic: the
+// pair leaves at its centre of mass velocity, with a fixed mass counting as
+// infinitely heavy. Every mass works out the change its contacts ask for
+// from the velocities before any change is made. It sums them in the order
+// of its neighbour list and takes the average. A separate pass then applies
+// the changes.
+//
+// The gather writes nothing another mass reads, so it runs in parallel over
+// fixed chunks of the active masses. The apply pass and the waking of hit
+// sleepers run in chunk order. The result is the same for every thread
+// count.
+void resolveMassContacts(Island &island, float dt) {
+  unsigned count = island.activeMasses.size();
+  unsigned chunks = (count + massContactChunk - 1) / massContactChunk;
+  island.contactDeltas.resize(count);
+  island.contactHits.resize(chunks);
+  island.contactSleepers.resize(chunks);
+
+  threadPool.parallelFor(chunks, [&island, count](unsigned chunk) {
+    std::vector<unsigned> &hits = island.contactHits[chunk];
+    std::vector<unsigned> &sleepers = island.contactSleepers[chunk];
+    hits.clear();
+    sleepers.clear();
+
+    unsigned end = std::min(count, (chunk + 1) * massContactChunk);
+    for (unsigned n = chunk * massContactChunk; n < end; n++) {
+      unsigned i = island.activeMasses[n];
+      Mass const &a = points[i];
+      Vec3f delta(0, 0, 0);
+      unsigned contacts = 0;
+
+      unsigned const *last = island.neighbours.end(i - island.massBegin);
+      for (unsigned const *k = island.neighbours.begin(i - island.massBegin);
+           k != last; k++) {
+        unsigned j = island.massBegin + *k;
+        Mass const &b = points[j];
+        Vec3f diff = a.position - b.position;
+        if (std::abs(diff.x()) >= collisionRadius ||
+            std::abs(diff.y()) >= collisionRadius ||
+            std::abs(diff.z()) >= collisionRadius)
+          continue;
+
+        // a contact reaching a sleeping region wakes it up
+        if (b.asleep)
+          sleepers.push_back(j);
+        float share = b.fixed ? 1 : b.mass / (a.mass + b.mass);
+        delta += share * (b.velocity - a.velocity);
+        contacts++;
+      }
+
+      if (contacts > 0 && !a.fixed) {
+        island.contactDeltas[n] = delta / contacts;
+        hits.push_back(n);
       }
     }
+  });
+
+  for (unsigned chunk = 0; chunk < chunks; chunk++) {
+    std::vector<unsigned> const &sleepers = island.contactSleepers[chunk];
+    for (unsigned k = 0; k < sleepers.size(); k++)
+      wakeRegion(regionOf(sleepers[k]));
+
+    std::vector<unsigned> const &hits = island.contactHits[chunk];
+    for (unsigned k = 0; k < hits.size(); k++) {
+      unsigned i = island.activeMasses[hits[k]];
+      Mass &m = points[i];
+      Vec3f delta = island.contactDeltas[hits[k]];
+      Vec3f velocity = m.velocity + delta;
+      regions[regionOf(i)].kineticEnergy +=
+          0.5 * m.mass *
+          (velocity.lengthSquared() - m.velocity.lengthSquared());
+      m.velocity = velocity;
+      m.position += dt * delta;
+    }
   }
-  return -1;
 }
 
 void updatePoints(int i, float dt){
 
 
-  float airDamping = 0.7;
-  if (view == 4)
-    airDamping = 0.2;
-
   float mass = points[i].mass;
   Vec3f force = points[i].force;
   Vec3f xta = points[i].position;
@@ -253,43 +915,6 @@ void updatePoints(int i, float dt){
   Vec3f xtdta = Vec3f(xta.x()+vtdta.x()*dt, xta.y()+vtdta.y()*dt, xta.z()+vtdta.z()*dt);
 
 
-  if (view == 5) {
-    int c = collision(i, xtdta);
-    if (c >= 0) {
-      vtdta = points[c].velocity;
-      xtdta = Vec3f(xta.x()+vtdta.x()*dt, xta.y()+vtdta.y()*dt, xta.z()+vtdta.z()*dt);
-    }
-  }
-
-  // make it collide with the ground
- if (view == 3)
-  {
-    float yvalueX = xta.y()+vtdta.y()*dt;
-    if (yvalueX <= ground) {
-      vtdta = Vec3f(vta.x()+ata.x()*dt, -(vta.y()+ata.y()*dt), vta.z()+ata.z()*dt)/2;
-      float yvalueV = vtdta.y();
-      if (yvalueV < 1) {
-        vtdta = Vec3f(vta.x()+ata.x()*dt, 0, vta.z()+ata.z()*dt);
-        xtdta.y() = ground;
-      }
-      else
-        xtdta = Vec3f(xta.x()+vtdta.x()*dt, xta.y()+vtdta.y()*dt, xta.z()+vtdta.z()*dt);
-    }
-  }
-  else if (view == 5) {
-    float tableHeight = -30;
-    float tableWidth = 50;
-    if (xtdta.y() <= tableHeight) {
-      if (xtdta.x() >= tableWidth/2 && xtdta.x() <= tableWidth) {
-        if (xtdta.z() <= -tableWidth/2 && xtdta.z() >= -tableWidth) {
-          vtdta = Vec3f(0,0,0);
-          xtdta.y() = tableHeight;
-        }
-      }
-      xtdta = Vec3f(xta.x()+vtdta.x()*dt, xta.y()+vtdta.y()*dt, xta.z()+vtdta.z()*dt);
-    }
-  }
-
   if (DEBUG == true){
     printf("mass position = %f %f %f \n", xta.x(), xta.y(), xta.z());
     printf("mass y velocity = %f, acceleration = %f \n", vtdta.y(), ata.y());
@@ -298,28 +923,667 @@ void updatePoints(int i, float dt){
   if (!points[i].fixed) {
     points[i].position = xtdta;
     points[i].velocity = vtdta;
+    regions[regionOf(i)].kineticEnergy += 0.5 * mass * vtdta.lengthSquared();
   }
   // reset forces
   points[i].force = Vec3f(0,0,0);
 
 }
 
-void animatePoints(float dt) {
+// The implicit half of an IMEX substep. calculateSprings has already put
+// every spring force into Mass::force; this solves the linearised backward
+// Euler system of the stiff springs for the velocity change and writes back
+// the force that makes updatePoints produce exactly that change, so
+// collisions and sleeping work the same in both integrators.
+void solveStiffSprings(Island &island, float h) {
+  ImexSolver &solver = island.imex;
+  solver.clear(island.imexMasses.size());
+
+  for (unsigned n = 0; n < island.imexMasses.size(); n++) {
+    Mass &m = points[island.imexMasses[n]];
+    Vec3f f = m.force + m.mass * g - airDamping * m.velocity;
+    solver.setUnknown(n, m.mass, h * f);
+  }
+
+  for (unsigned n = 0; n < island.activeStiffSprings.size(); n++) {
+    Spring &s = springs[island.activeStiffSprings[n]];
+    Vec3f ab = s.b->position - s.a->position;
+    float currentLength = ab.length();
+    if (currentLength == 0)
+      continue;
+    Vec3f u = ab / currentLength;
+
+    // h^2 * K = -(alphaK * I + betaK * u * u^T), dropping the compressive
+    // part of the transverse term so the system stays positive definite
+    float alphaK = h * h * s.stiffness *
+                   std::max(0.f, 1 - s.restLength / currentLength);
+    float betaK = h * h * s.stiffness * s.restLength / currentLength;
+    float betaC = h * s.damping;
+
+    int a = island.imexIndex[massIndex(s.a) - island.massBegin];
+    int b = island.imexIndex[massIndex(s.b) - island.massBegin];
+
+    // the h^2 * K * v term of the right hand side
+    Vec3f relativeVelocity = s.a->velocity - s.b->velocity;
+    Vec3f Kv = alphaK * relativeVelocity +
+               (betaK * (u * relativeVelocity)) * u;
+    if (a >= 0)
+      solver.addRhs(a, -Kv);
+    if (b >= 0)
+      solver.addRhs(b, Kv);
+
+    solver.addSpring(a, b, u, alphaK, betaK + betaC);
+  }
+
+  solver.solve(imexIterations, imexTolerance);
+
+  for (unsigned n = 0; n < island.imexMasses.size(); n++) {
+    Mass &m = points[island.imexMasses[n]];
+    m.force = m.mass * solver.deltaV(n) / h - m.mass * g +
+              airDamping * m.velocity;
+  }
+}
+
+// Separates the cloth where it has come within the thickness of itself. Each
+// contact gets an inelastic impulse that cancels the approaching relative
+// velocity of its pair, and a repulsion that separates it by a tenth of the
+// overlap per substep (Bridson et al. 2002), shared out by the weights and
+// inverse masses so fixed masses don't move. Only velocities change, so the
+// springs don't see sudden jumps.
+//
+// The impulse a contact got last substep is given again first, and the pass
+// then only corrects it, never below zero. Cloth resting on itself needs
+// much the same impulse every substep, so it settles in one pass.
+//
+// A pair further apart than the thickness and skin at a full pass can't get
+// closer than half the thickness before the masses have gone a quarter of
+// it and half the skin, so until then the pairs cached by the last full pass
+// are refreshed instead. Slow cloth gets a full pass every few frames, fast
+// cloth every substep.
+void resolveSelfCollisions(Island &island, float dt, bool full) {
+  if (full) {
+    island.clothTravel = 0;
+    island.cloth.update(island.positions, threadPool);
+    island.cloth.findContacts(island.positions, threadPool);
+  } else {
+    island.cloth.refreshContacts(island.positions);
+  }
+
+  std::vector<Contact> const &contacts = island.cloth.contacts();
+  for (unsigned n = 0; n < contacts.size(); n++) {
+    Contact const &contact = contacts[n];
+    if (contact.impulse == 0)
+      continue;
+    for (unsigned k = 0; k < 4; k++) {
+      Mass &m = points[island.massBegin + contact.vertex[k]];
+      if (!m.fixed)
+        m.velocity += (contact.weight[k] * contact.impulse / m.mass) *
+                      contact.normal;
+    }
+  }
+
+  for (unsigned n = 0; n < contacts.size(); n++) {
+    Contact const &contact = contacts[n];
+    Mass *m[4];
+    float inverseMass[4];
+    float denom = 0;
+    float approach = 0;
+    for (unsigned k = 0; k < 4; k++) {
+      m[k] = &points[island.massBegin + contact.vertex[k]];
+      inverseMass[k] = m[k]->fixed ? 0 : 1 / m[k]->mass;
+      denom += contact.weight[k] * contact.weight[k] * inverseMass[k];
+      approach += contact.weight[k] * (m[k]->velocity * contact.normal);
+    }
+    if (denom == 0)
+      continue;
+
+    float separation = 0.1 * contact.depth / dt;
+    float total = std::max(0.f, contact.impulse +
+                                    (separation - approach) / denom);
+    island.cloth.setImpulse(n, total);
+    if (total == 0 && contact.impulse == 0)
+      continue;
+
+    // takes back whatever of the last impulse wasn't needed
+    float impulse = total - contact.impulse;
+    for (unsigned k = 0; k < 4; k++) {
+      float share = contact.weight[k] * inverseMass[k];
+      m[k]->velocity += (share * impulse) * contact.normal;
+      if (total > 0 && m[k]->asleep)
+        wakeRegion(regionOf(massIndex(m[k])));
+    }
+  }
+}
+
+// The continuous pass over the substep from island.stepStart to the
+// positions updatePoints left. Every impact gets an inelastic impulse that
+// stops its pair approaching along the normal, the masses move to where the
+// new velocities take them over the substep, and the step is checked again.
+// Whatever still collides after impactRounds is put back at the start of the
+// substep, which was free of crossings.
+void resolveImpacts(Island &island, float dt, bool sweepAll) {
+  for (int round = 0; round < 2 * impactRounds; round++) {
+    if (sweepAll)
+      island.cloth.findImpacts(island.stepStart, island.positions, threadPool);
+    else
+      island.cloth.findNearImpacts(island.stepStart, island.positions);
+
+    std::vector<Contact> const &impacts = island.cloth.contacts();
+    if (impacts.empty())
+      return;
+
+    for (unsigned n = 0; n < impacts.size(); n++) {
+      Contact const &impact = impacts[n];
+      Mass *m[4];
+      float inverseMass[4];
+      float denom = 0;
+      float approach = 0;
+      for (unsigned k = 0; k < 4; k++) {
+        m[k] = &points[island.massBegin + impact.vertex[k]];
+        inverseMass[k] = m[k]->fixed ? 0 : 1 / m[k]->mass;
+        denom += impact.weight[k] * impact.weight[k] * inverseMass[k];
+        approach += impact.weight[k] * (m[k]->velocity * impact.normal);
+        if (m[k]->asleep)
+          wakeRegion(regionOf(massIndex(m[k])));
+      }
+
+      bool freeze = round >= impactRounds;
+      if (!freeze && (denom == 0 || approach >= 0))
+        continue;
+
+      float impulse = freeze ? 0 : -approach / denom;
+      for (unsigned k = 0; k < 4; k++) {
+        if (m[k]->fixed)
+          continue;
+        unsigned local = impact.vertex[k];
+        if (freeze)
+          m[k]->velocity = Vec3f(0,0,0);
+        else
+          m[k]->velocity +=
+              (impact.weight[k] * inverseMass[k] * impulse) * impact.normal;
+        m[k]->position = island.stepStart[local] + dt * m[k]->velocity;
+        island.positions[local] = m[k]->position;
+      }
+    }
+  }
+}
+
+// Self-collision after the masses have moved. Pairs the last full proximity
+// pass found further apart than the thickness and skin can't have crossed
+// until the masses have gone half of that since, so until then the
+// continuous pass only checks the close pairs, and after that it sweeps the
+// whole cloth.
+void collideCloth(Island &island, float dt) {
+  island.positions.resize(island.massEnd - island.massBegin);
+  float maxSpeedSq = 0;
+  for (unsigned i = island.massBegin; i < island.massEnd; i++) {
+    island.positions[i - island.massBegin] = points[i].position;
+    maxSpeedSq = std::max(maxSpeedSq, points[i].velocity.lengthSquared());
+  }
+
+  island.clothTravel += std::sqrt(maxSpeedSq) * dt;
+  float reach = clothThickness + clothContactSkin;
+  resolveImpacts(island, dt, island.clothTravel >= 0.5 * reach);
+  resolveSelfCollisions(island, dt,
+                        island.clothTravel >= 0.25 * clothThickness +
+                                                  0.5 * clothContactSkin);
+}
+
+// Runs the obstacle pass over the masses updatePoints just moved. The sleep
+// test counted their kinetic energy before the response changed it, so the
+// difference goes to their regions.
+void collideObstacles(Island &island) {
+  ColliderBatch &batch = island.obstacles;
+  for (unsigned n = 0; n < island.activeMasses.size(); n++) {
+    Mass const &m = points[island.activeMasses[n]];
+    batch.set(n, m.position, m.velocity);
+  }
+
+  colliders.collide(batch);
+
+  for (unsigned n = 0; n < island.activeMasses.size(); n++) {
+    unsigned i = island.activeMasses[n];
+    if (!batch.touched(n) || points[i].fixed)
+      continue;
+    Vec3f velocity = batch.velocity(n);
+    regions[regionOf(i)].kineticEnergy +=
+        0.5 * points[i].mass *
+        (velocity.lengthSquared() - points[i].velocity.lengthSquared());
+    points[i].position = batch.position(n);
+    points[i].velocity = velocity;
+  }
+}
+
+// Pulls the dragged mass towards dragTarget. Only an awake mass gets the
+// force, as updatePoints is what clears it again.
+void applyDragForce() {
+  Mass &m = points[simulationDragMass];
+  if (m.fixed || m.asleep)
+    return;
+  m.force += m.mass * (dragStiffness * (simulationDragTarget - m.position) -
+                       dragDamping * m.velocity);
+}
+
+void stepIsland(Island &island, float dt) {
+  // cover the same 10 * dt as everybody else, in more substeps if dt is
+  // past what this island's springs stay stable with
+  float maxDt = integrator == IMEX ? island.maxDtImex : island.maxDt;
+  int substeps = 10;
+  if (dt > maxDt) {
+    substeps = ceil(10 * dt / maxDt);
+    dt = 10 * dt / substeps;
+  }
+  island.dt = dt;
 
   // calculate spring forces
-  for (int timestep = 0; timestep < 10; timestep++) {
-    for (unsigned i = 0; i < springs.size(); i++) {
-      calculateSprings(i, dt);
+  for (int timestep = 0; timestep < substeps; timestep++) {
+    if (island.activeSetsDirty)
+      rebuildActiveSets(island);
+
+    for (unsigned n = 0; n < island.activeSprings.size(); n++) {
+      calculateSprings(island.activeSprings[n], dt);
+    }
+
+    if (simulationDragMass >= int(island.massBegin) &&
+        simulationDragMass < int(island.massEnd))
+      applyDragForce();
+
+    if (integrator == IMEX)
+      solveStiffSprings(island, dt);
+
+    if (view == 5)
+      updateNeighbourLists(island, dt, substeps - timestep);
+
+    if (!island.cloth.empty()) {
+      island.stepStart.resize(island.massEnd - island.massBegin);
+      for (unsigned i = island.massBegin; i < island.massEnd; i++)
+        island.stepStart[i - island.massBegin] = points[i].position;
+    }
+
+    if (!colliders.empty()) {
+      island.obstacles.resize(island.activeMasses.size());
+      for (unsigned n = 0; n < island.activeMasses.size(); n++)
+        island.obstacles.setStart(n, points[island.activeMasses[n]].position);
     }
 
     // update masses
-    for (unsigned i = 0; i < points.size(); i++) {
-      updatePoints(i, dt);
+    for (unsigned n = 0; n < island.activeMasses.size(); n++) {
+      updatePoints(island.activeMasses[n], dt);
+    }
+
+    if (view == 5)
+      resolveMassContacts(island, dt);
+
+    if (!colliders.empty())
+      collideObstacles(island);
+
+    if (!island.cloth.empty())
+      collideCloth(island, dt);
+
+    updateSleepStates(island);
+  }
+
+  fitIslandBounds(island);
+}
+
+// Pushes apart the masses of two islands closer than objectContactDistance.
+// Only the masses within reach of the other island's box can be, and there
+// are few of them, so every such pair is tried. A contact moves the masses
+// apart in inverse proportion to their mass, then stops them closing in, with
+// Coulomb friction on their sliding. Sleeping masses hold still unless hit
+// faster than objectWakeSpeed, which wakes them.
+void collideIslands(Island const &a, Island const &b) {
+  float reach = 0.5 * objectContactDistance;
+  std::vector<unsigned> nearA, nearB;
+  for (unsigned i = a.massBegin; i < a.massEnd; i++) {
+    if (b.bounds.overlaps(Aabb::around(points[i].position, reach)))
+      nearA.push_back(i);
+  }
+  for (unsigned j = b.massBegin; j < b.massEnd; j++) {
+    if (a.bounds.overlaps(Aabb::around(points[j].position, reach)))
+      nearB.push_back(j);
+  }
+
+  float contactSq = objectContactDistance * objectContactDistance;
+  for (unsigned n = 0; n < nearA.size(); n++) {
+    Mass &ma = points[nearA[n]];
+    for (unsigned k = 0; k < nearB.size(); k++) {
+      Mass &mb = points[nearB[k]];
+      Vec3f d = mb.position - ma.position;
+      float distSq = d.lengthSquared();
+      if (distSq >= contactSq || distSq <= 0 || (ma.asleep && mb.asleep))
+        continue;
+
+      float dist = std::sqrt(distSq);
+      Vec3f normal = d / dist;
+      Vec3f relative = ma.velocity - mb.velocity;
+      float approach = relative * normal;
+      if (approach > objectWakeSpeed) {
+        if (ma.asleep)
+          wakeRegion(regionOf(nearA[n]));
+        if (mb.asleep)
+          wakeRegion(regionOf(nearB[k]));
+      }
+
+      float wa = ma.fixed || ma.asleep ? 0 : 1 / ma.mass;
+      float wb = mb.fixed || mb.asleep ? 0 : 1 / mb.mass;
+      if (wa + wb <= 0)
+        continue;
+
+      float push = (objectContactDistance - dist) / (wa + wb);
+      ma.position -= push * wa * normal;
+      mb.position += push * wb * normal;
+      if (approach <= 0)
+        continue;
+
+      float impulse = approach / (wa + wb);
+      Vec3f change = impulse * normal;
+      Vec3f slide = relative - approach * normal;
+      float slideSpeed = slide.length();
+      if (slideSpeed > 0) {
+        float friction = std::min(objectFriction * impulse,
+                                  slideSpeed / (wa + wb));
+        change += friction / slideSpeed * slide;
+      }
+      ma.velocity -= wa * change;
+      mb.velocity += wb * change;
+    }
+  }
+}
+
+// Contact between the islands after they have all stepped, the broadphase
+// updated from the boxes they moved to.
+void collideObjects() {
+  if (islands.size() < 2)
+    return;
+
+  objectBoxes.resize(islands.size());
+  for (unsigned n = 0; n < islands.size(); n++)
+    objectBoxes[n] = islands[n].bounds;
+  objectPairs.update(objectBoxes);
+
+  std::vector<SweepAndPrune::Pair> const &pairs = objectPairs.pairs();
+  for (unsigned n = 0; n < pairs.size(); n++)
+    collideIslands(islands[pairs[n].a], islands[pairs[n].b]);
+}
+
+void animatePoints(float dt) {
+  int steps = 1;
+  if (islands.size() > 1 && 10 * dt > objectContactStep)
+    steps = ceil(10 * dt / objectContactStep);
+  dt /= steps;
+
+  for (int step = 0; step < steps; step++) {
+    threadPool.parallelFor(islands.size(), [dt](unsigned n) {
+      stepIsland(islands[n], dt);
+    });
+    collideObjects();
+  }
+}
+
+// One frame of simulation, with simulationMutex held. The dragged mass and
+// its target are taken as the renderer last left them, and the mass kept
+// awake to follow.
+void stepSimulation() {
+  {
+    std::lock_guard<std::mutex> lock(dragTargetMutex);
+    simulationDragMass = dragMass;
+    simulationDragTarget = dragTarget;
+  }
+  if (simulationDragMass >= 0)
+    wakeRegion(regionOf(simulationDragMass));
+
+  animatePoints(frameStep);
+}
+
+// Hands the renderer what it needs of the simulation as it stands.
+void publishFrame() {
+  SimulationFrame &frame = simulationFrames.back();
+  frame.positions.resize(points.size());
+  frame.bounds = Aabb::empty();
+  for (unsigned i = 0; i < points.size(); i++) {
+    frame.positions[i] = points[i].position;
+    frame.bounds.grow(points[i].position);
+  }
+  refitPicker(frame.positions);
+  frame.time = wallSeconds();
+  simulationFrames.publish();
+}
+
+// The simulation thread. A frame that runs past its time is followed
+// straight away by the next, but the time lost isn't made up.
+void simulationLoop() {
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point next = Clock::now();
+
+  while (!simulationQuit) {
+    next += std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1 / simulationRate));
+    {
+      std::lock_guard<std::mutex> lock(simulationMutex);
+      if (g_play) {
+        stepSimulation();
+        publishFrame();
+      }
+    }
+
+    Clock::time_point now = Clock::now();
+    if (next < now)
+      next = now;
+    else
+      std::this_thread::sleep_until(next);
+  }
+}
+
+// Starts the scene of nextView from the beginning, and gives the renderer
+// its first frame before the simulation thread takes over again.
+void restartScene(int nextView) {
+  {
+    std::lock_guard<std::mutex> lock(simulationMutex);
+    view = nextView;
+    setupPoints();
+    publishFrame();
+  }
+  simulationFrames.acquire();
+  previousFrame = simulationFrames.front();
+  frameBlend = 1;
+  buildPicker();
+
+  loadLineGeometryToGPU();
+  loadSurfaceGeometryToGPU();
+  loadQuadGeometryToGPU();
+}
+
+// Seconds by a clock that only goes forwards, with or without a window.
+double wallSeconds() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Takes the latest simulation frame, if there is a new one, keeping the one
+// it follows to blend from. Returns false if there wasn't.
+bool acquireFrame() {
+  if (!simulationFrames.fresh())
+    return false;
+
+  previousFrame = simulationFrames.front();
+  simulationFrames.acquire();
+  return true;
+}
+
+// How far from the previous frame to the latest the masses are drawn now.
+// Straight at the latest if there is nothing to blend from.
+void updateFrameBlend() {
+  SimulationFrame const &latest = simulationFrames.front();
+  double interval = latest.time - previousFrame.time;
+  frameBlend = 1;
+  if (interval > 0 &&
+      previousFrame.positions.size() == latest.positions.size())
+    frameBlend = std::min(1.0, (wallSeconds() - latest.time) / interval);
+}
+
+// Adds the jelly cube of view 3 with its front top left corner at origin.
+// The springs point into points, so reserve room for every cube first.
+void addJellyCube(Vec3f origin) {
+  unsigned base = points.size();
+  float weight = 0.5;
+  float k = 10;
+  float c = 0.3;
+
+  // set up masses
+  // front
+  int x, y, z;
+  x = y = z = 0;
+  for (unsigned i = 0; i < 9; i++) {
+    Mass m;
+    m.mass = weight;
+    m.position = origin + Vec3f(x, y, z);
+    m.velocity = Vec3f(0,0,0);
+    m.force = Vec3f(0,0,0);
+    m.fixed = false;
+
+    x += 5;
+    // every third point go down 5
+    if ((i+1) % 3 == 0) {
+      y -= 5;
+      x = 0;
+    }
+    points.push_back(m);
+  }
+
+  // middle
+  x = y = 0;
+  z += -5;
+  for (unsigned i = 0; i < 9; i++) {
+    Mass m;
+    m.mass = weight;
+    m.position = origin + Vec3f(x, y, z);
+    m.velocity = Vec3f(0,0,0);
+    m.force = Vec3f(0,0,0);
+    m.fixed = false;
+
+    x += 5;
+    // every third point go down 5
+    if ((i+1) % 3 == 0) {
+      y -= 5;
+      x = 0;
+    }
+    points.push_back(m);
+  }
+
+  // back
+  x = y = 0;
+  z += -5;
+  for (unsigned i = 0; i < 9; i++) {
+    Mass m;
+    m.mass = weight;
+    m.position = origin + Vec3f(x, y, z);
+    m.velocity = Vec3f(0,0,0);
+    m.force = Vec3f(0,0,0);
+    m.fixed = false;
+
+    x += 5;
+    // every third point go down 5
+    if ((i+1) % 3 == 0) {
+      y -= 5;
+      x = 0;
+    }
+    points.push_back(m);
+  }
+
+  // set up springs
+  int a = 0;
+  for (unsigned n = 0; n < 3; n++) {
+    for (unsigned j = 0; j < 9; j++) {
+      // horizontal -->
+      if ((a+1)%3 != 0) { // if not on right edge make horizontal spring (pointing right)
+        Spring sh;
+        sh.a = &points[base + a];
+        sh.b = &points[base + a+1];
+        sh.stiffness = k;
+        sh.restLength = 5;
+        sh.damping = c;
+
+        springs.push_back(sh);
+      }
+      // vertical ^
+      if (a <= 23 && a >= 18) {   // if not on bottom edge make vertical spring (pointing up)
+        Spring sv;
+        sv.a = &points[base + a];
+        sv.b = &points[base + a+3];
+        sv.stiffness = k;
+        sv.restLength = 5;
+        sv.damping = c;
+        springs.push_back(sv);
+      }
+      else if (a <= 14 && a >= 9) {   // if not on bottom edge make vertical spring (pointing up)
+        Spring sv;
+        sv.a = &points[base + a];
+        sv.b = &points[base + a+3];
+        sv.stiffness = k;
+        sv.restLength = 5;
+        sv.damping = c;
+        springs.push_back(sv);
+      }
+      else if (a <= 5) {   // if not on bottom edge make vertical spring (pointing up)
+        Spring sv;
+        sv.a = &points[base + a];
+        sv.b = &points[base + a+3];
+        sv.stiffness = k;
+        sv.restLength = 5;
+        sv.damping = c;
+        springs.push_back(sv);
+      }
+      a++;
+    }
+  }
+
+  // connect the three massive masses with more springs
+  for (unsigned j = 0; j < 26; j++) {
+    if (j <= 17) {   // if not on bottom edge make vertical spring (pointing up)
+      Spring sv;
+      sv.a = &points[base + j];
+      sv.b = &points[base + j+9];
+      sv.stiffness = k;
+      sv.restLength = 5;
+      sv.damping = c;
+      springs.push_back(sv);
+    }
+
+    // down right
+    for (unsigned i = 0; i < 23; i++) {
+      Spring sv;
+      if (((i >= 0 && i < 5)|| (i > 8 && i < 14) || (i > 17  && i < 23)) && (i != 2 && i != 11 && i != 20)) {
+        sv.a = &points[base + i];
+        sv.b = &points[base + i+4];
+        sv.stiffness = k-2;
+        sv.restLength = sqrt(50);
+        sv.damping = c;
+        springs.push_back(sv);
+      }
+    }
+
+    // down left
+    for (unsigned i = 0; i < 24; i++) {
+      Spring sv;
+      if (((i > 0 && i < 6)|| (i > 9 && i < 15) || (i > 18  && i < 24)) && (i != 3 && i != 12 && i != 21)) {
+        sv.a = &points[base + i];
+        sv.b = &points[base + i+2];
+        sv.stiffness = k-2;
+        sv.restLength = sqrt(50);
+        sv.damping = c;
+        springs.push_back(sv);
+      }
     }
+
   }
 }
 
 void setupPoints() {
+  latticeLength = latticeWidth = 0;
+  airDamping = 0.1;
+
   // reset points and springs vectors
   if (view == 1)
   {
@@ -347,7 +1611,7 @@ void setupPoints() {
     ABs.b = &points[1];
     ABs.stiffness = 30;
     ABs.restLength = 5;
-    ABs.damping = 0;
+    ABs.damping = 1.5;
 
     springs.push_back(ABs);
   }
@@ -393,21 +1657,21 @@ void setupPoints() {
     ABs.b = &points[1];
     ABs.stiffness = 30;
     ABs.restLength = 5;
-    ABs.damping = 0;
+    ABs.damping = 1.5;
 
     Spring BCs;
     BCs.a = &points[1];
     BCs.b = &points[2];
     BCs.stiffness = 30;
     BCs.restLength = 5;
-    BCs.damping = 0;
+    BCs.damping = 1.5;
 
     Spring CDs;
     CDs.a = &points[2];
     CDs.b = &points[3];
     CDs.stiffness = 30;
     CDs.restLength = 5;
-    CDs.damping = 0;
+    CDs.damping = 1.5;
 
     springs.push_back(ABs);
     springs.push_back(BCs);
@@ -417,156 +1681,9 @@ void setupPoints() {
   {
     points.erase(points.begin(),points.begin()+points.size());
     springs.erase(springs.begin(),springs.begin()+springs.size());
-    float weight = 0.5;
-    float k = 10;
-
-    // set up masses
-    // front
-    int x, y, z;
-    x = y = z = 0;
-    for (unsigned i = 0; i < 9; i++) {
-      Mass m;
-      m.mass = weight;
-      m.position = Vec3f(x, y, z);
-      m.velocity = Vec3f(0,0,0);
-      m.force = Vec3f(0,0,0);
-      m.fixed = false;
-
-      x += 5;
-      // every third point go down 5
-      if ((i+1) % 3 == 0) {
-        y -= 5;
-        x = 0;
-      }
-      points.push_back(m);
-    }
-
-    // middle
-    x = y = 0;
-    z += -5;
-    for (unsigned i = 0; i < 9; i++) {
-      Mass m;
-      m.mass = weight;
-      m.position = Vec3f(x, y, z);
-      m.velocity = Vec3f(0,0,0);
-      m.force = Vec3f(0,0,0);
-      m.fixed = false;
-
-      x += 5;
-      // every third point go down 5
-      if ((i+1) % 3 == 0) {
-        y -= 5;
-        x = 0;
-      }
-      points.push_back(m);
-    }
-
-    // back
-    x = y = 0;
-    z += -5;
-    for (unsigned i = 0; i < 9; i++) {
-      Mass m;
-      m.mass = weight;
-      m.position = Vec3f(x, y, z);
-      m.velocity = Vec3f(0,0,0);
-      m.force = Vec3f(0,0,0);
-      m.fixed = false;
-
-      x += 5;
-      // every third point go down 5
-      if ((i+1) % 3 == 0) {
-        y -= 5;
-        x = 0;
-      }
-      points.push_back(m);
-    }
-
-    // set up springs
-    int a = 0;
-    for (unsigned n = 0; n < 3; n++) {
-      for (unsigned j = 0; j < 9; j++) {
-        // horizontal -->
-        if ((a+1)%3 != 0) { // if not on right edge make horizontal spring (pointing right)
-          Spring sh;
-          sh.a = &points[a];
-          sh.b = &points[a+1];
-          sh.stiffness = k;
-          sh.restLength = 5;
-          sh.damping = 0;
-
-          springs.push_back(sh);
-        }
-        // vertical ^
-        if (a <= 23 && a >= 18) {   // if not on bottom edge make vertical spring (pointing up)
-          Spring sv;
-          sv.a = &points[a];
-          sv.b = &points[a+3];
-          sv.stiffness = k;
-          sv.restLength = 5;
-          sv.damping = 0;
-          springs.push_back(sv);
-        }
-        else if (a <= 14 && a >= 9) {   // if not on bottom edge make vertical spring (pointing up)
-          Spring sv;
-          sv.a = &points[a];
-          sv.b = &points[a+3];
-          sv.stiffness = k;
-          sv.restLength = 5;
-          sv.damping = 0;
-          springs.push_back(sv);
-        }
-        else if (a <= 5) {   // if not on bottom edge make vertical spring (pointing up)
-          Spring sv;
-          sv.a = &points[a];
-          sv.b = &points[a+3];
-          sv.stiffness = k;
-          sv.restLength = 5;
-          sv.damping = 0;
-          springs.push_back(sv);
-        }
-        a++;
-      }
-    }
-
-    // connect the three massive masses with more springs
-    for (unsigned j = 0; j < 26; j++) {
-      if (j <= 17) {   // if not on bottom edge make vertical spring (pointing up)
-        Spring sv;
-        sv.a = &points[j];
-        sv.b = &points[j+9];
-        sv.stiffness = k;
-        sv.restLength = 5;
-        sv.damping = 0;
-        springs.push_back(sv);
-      }
-
-      // down right
-      for (unsigned i = 0; i < 23; i++) {
-        Spring sv;
-        if (((i >= 0 && i < 5)|| (i > 8 && i < 14) || (i > 17  && i < 23)) && (i != 2 && i != 11 && i != 20)) {
-          sv.a = &points[i];
-          sv.b = &points[i+4];
-          sv.stiffness = k-2;
-          sv.restLength = sqrt(50);
-          sv.damping = 0;
-          springs.push_back(sv);
-        }
-      }
-
-      // down left
-      for (unsigned i = 0; i < 24; i++) {
-        Spring sv;
-        if (((i > 0 && i < 6)|| (i > 9 && i < 15) || (i > 18  && i < 24)) && (i != 3 && i != 12 && i != 21)) {
-          sv.a = &points[i];
-          sv.b = &points[i+2];
-          sv.stiffness = k-2;
-          sv.restLength = sqrt(50);
-          sv.damping = 0;
-          springs.push_back(sv);
-        }
-      }
-
-    }
+    // the jelly needs the drag to land softly, a faster landing crushes it
+    airDamping = 0.7;
+    addJellyCube(Vec3f(0,0,0));
   }
 
   else if (view == 4) {
@@ -574,6 +1691,8 @@ void setupPoints() {
     springs.erase(springs.begin(),springs.begin()+springs.size());
 
     float k = 50;
+    float c = 0.5;
+    airDamping = 0.02;
     float pointMass = 0.5;
     float restLength = 2;
     unsigned int clothLength = 50;
@@ -608,7 +1727,7 @@ void setupPoints() {
         sh.b = &points[j+1];
         sh.stiffness = k;
         sh.restLength = restLength;
-        sh.damping = 0;
+        sh.damping = c;
         springs.push_back(sh);
 
         // work with down right
@@ -618,7 +1737,7 @@ void setupPoints() {
           s.b = &points[j+clothLength+1];
           s.stiffness = k-5;
           s.restLength = sqrt((restLength*restLength)*2);
-          s.damping = 0;
+          s.damping = c;
           springs.push_back(s);
         }
       }
@@ -630,7 +1749,7 @@ void setupPoints() {
         s.b = &points[j+clothLength-1];
         s.stiffness = k-5;
         s.restLength = sqrt((restLength*restLength)*2);
-        s.damping = 0;
+        s.damping = c;
         springs.push_back(s);
       }
     }
@@ -642,9 +1761,11 @@ void setupPoints() {
       s.b = &points[j+clothLength];
       s.stiffness = k;
       s.restLength = restLength;
-      s.damping = 0;
+      s.damping = c;
       springs.push_back(s);
     }
+    latticeLength = clothLength;
+    latticeWidth = clothWidth;
     // end part 4
   }
 
@@ -653,6 +1774,8 @@ void setupPoints() {
     springs.erase(springs.begin(),springs.begin()+springs.size());
 
     float k = 50;
+    float c = 0.5;
+    airDamping = 0.05;
     float pointMass = 0.5;
     float restLength = 2;
     unsigned int clothLength = 50;
@@ -683,7 +1806,7 @@ void setupPoints() {
         sh.b = &points[j+1];
         sh.stiffness = k;
         sh.restLength = restLength;
-        sh.damping = 0;
+        sh.damping = c;
         springs.push_back(sh);
 
         // work with down right
@@ -693,7 +1816,7 @@ void setupPoints() {
           s.b = &points[j+clothLength+1];
           s.stiffness = k-5;
           s.restLength = sqrt((restLength*restLength)*2);
-          s.damping = 0;
+          s.damping = c;
           springs.push_back(s);
         }
       }
@@ -705,7 +1828,7 @@ void setupPoints() {
         s.b = &points[j+clothLength-1];
         s.stiffness = k-5;
         s.restLength = sqrt((restLength*restLength)*2);
-        s.damping = 0;
+        s.damping = c;
         springs.push_back(s);
       }
     }
@@ -717,54 +1840,225 @@ void setupPoints() {
       s.b = &points[j+clothLength];
       s.stiffness = k;
       s.restLength = restLength;
-      s.damping = 0;
+      s.damping = c;
       springs.push_back(s);
     }
+    latticeLength = clothLength;
+    latticeWidth = clothWidth;
     // end part 5
   }
-}
 
-void loadQuadGeometryToGPU(float width) {
-  std::vector<Vec3f> verts;
-
-  for (unsigned i = 0; i < points.size(); ++i) {
-    float x = points[i].position.x();
-    float y = points[i].position.y();
-    float z = points[i].position.z();
+  else if (view == 6) {
+    points.erase(points.begin(),points.begin()+points.size());
+    springs.erase(springs.begin(),springs.begin()+springs.size());
 
-    if (DEBUG == true)
-      std::cout << "points[" << i << "] x = " << x << ", y = " << y << ", z = " << z << std::endl;
+    // four rows of four jelly cubes, every cube its own island, the two
+    // halves of each row thrown at each other along it
+    unsigned cubesAcross = 4;
+    float spacing = 16;
+    float throwSpeed = 5;
+    airDamping = 0.7;
+    points.reserve(27 * cubesAcross * cubesAcross);
+    for (unsigned row = 0; row < cubesAcross; row++) {
+      for (unsigned column = 0; column < cubesAcross; column++) {
+        unsigned base = points.size();
+        float height = 5 * ((row + column) % 3);
+        addJellyCube(Vec3f(spacing * column, height, -spacing * row));
+
+        float speed = 2 * column < cubesAcross ? throwSpeed : -throwSpeed;
+        for (unsigned i = base; i < points.size(); i++)
+          points[i].velocity = Vec3f(speed, 0, 0);
+      }
+    }
+  }
 
-    verts.push_back(Vec3f(-0.5*width+x, -0.5*width+y, 0*width+z));
-    verts.push_back(Vec3f(-0.5*width+x, 0.5*width+y, 0*width+z));
-    verts.push_back(Vec3f(0.5*width+x, 0.5*width+y, 0*width+z));
+  buildIslands();
+  resetSleepStates();
 
-    verts.push_back(Vec3f(0.5*width+x, 0.5*width+y, 0*width+z));
-    verts.push_back(Vec3f(0.5*width+x, -0.5*width+y, 0*width+z));
-    verts.push_back(Vec3f(-0.5*width+x, -0.5*width+y, 0*width+z));
+  objectPairs.clear();
+  {
+    std::lock_guard<std::mutex> lock(pickerMutex);
+    pickersBuilt = false;
+  }
+  dragMass = -1;
+  simulationDragMass = -1;
+
+  colliders.clear();
+  if (view == 3 || view == 6) {
+    colliders.addPlane(Vec3f(0, 1, 0), ground, groundMaterial);
+  } else if (view == 5) {
+    colliders.addBox(Vec3f(tableWidth / 2, tableHeight - tableThickness,
+                           -tableWidth),
+                     Vec3f(tableWidth, tableHeight, -tableWidth / 2),
+                     tableMaterial);
+  }
 
+  // the lattices are a single island, still in row major order
+  if (latticeLength > 0 && latticeWidth > 0) {
+    islands[0].cloth.setLattice(latticeLength, latticeWidth);
+    islands[0].cloth.setThickness(clothThickness);
+    islands[0].cloth.setCache(clothContactSkin, clothContactTolerance);
+    islands[0].clothTravel = std::numeric_limits<float>::max();
   }
-  if (DEBUG == true)
-    std::cout << " --- " << std::endl;
+}
+
+// The quad every mass is drawn with, scaled by masswidth in the shader.
+void loadUnitQuadToGPU() {
+  Vec3f verts[6] = {Vec3f(-0.5, -0.5, 0), Vec3f(-0.5, 0.5, 0),
+                    Vec3f(0.5, 0.5, 0),   Vec3f(0.5, 0.5, 0),
+                    Vec3f(0.5, -0.5, 0),  Vec3f(-0.5, -0.5, 0)};
+
   glBindBuffer(GL_ARRAY_BUFFER, vertBufferID);
   glBufferData(GL_ARRAY_BUFFER,
-               sizeof(Vec3f) * 6 * points.size(), // byte size of Vec3f, 6 of them
-               verts.data(),      // pointer (Vec3f*) to contents of verts
+               sizeof(verts),     // byte size of Vec3f, 6 of them
+               verts,             // pointer (Vec3f*) to contents of verts
                GL_STATIC_DRAW);   // Usage pattern of GPU buffer
 }
 
+// Mass i where it is drawn this frame, frameBlend of the way from the
+// previous simulation frame to the latest.
+inline Vec3f drawnPosition(std::vector<Vec3f> const &latest, unsigned i) {
+  if (frameBlend >= 1)
+    return latest[i];
+  Vec3f const &previous = previousFrame.positions[i];
+  return previous + frameBlend * (latest[i] - previous);
+}
+
+// Writes position i of the mass buffer, as floats or quantized into the
+// box of this frame.
+inline void storePosition(void *verts, unsigned i, Vec3f const &p) {
+  if (!quantizedPositions) {
+    static_cast<Vec3f *>(verts)[i] = p;
+    return;
+  }
+
+  unsigned short *q = static_cast<unsigned short *>(verts) + 3 * i;
+  for (int axis = 0; axis < 3; axis++) {
+    float t = (p[axis] - positionOrigin[axis]) * positionInverse[axis];
+    t = std::min(std::max(t, 0.f), 65535.f);
+    q[axis] = static_cast<unsigned short>(t + 0.5f);
+  }
+}
+
+// The box the quantized positions are in: around the masses of the frames
+// blended, and the end of the drag spring.
+void fitPositionBox() {
+  Aabb box = simulationFrames.front().bounds;
+  if (frameBlend < 1)
+    box.grow(previousFrame.bounds);
+  if (dragMass >= 0)
+    box.grow(dragTarget);
+
+  positionOrigin = box.min;
+  for (int axis = 0; axis < 3; axis++) {
+    float extent = box.max[axis] - box.min[axis];
+    positionScale[axis] = extent;
+    positionInverse[axis] = extent > 0 ? 65535 / extent : 0;
+  }
+}
+
+// Only the positions change, one per mass; the quads are made from them by
+// instancing, and the springs drawn between them by index. After the masses
+// comes the end of the spring of the mass being dragged. They are the ones
+// of the latest simulation frame, uploadChunk of them to a task.
+void loadQuadGeometryToGPU() {
+  std::vector<Vec3f> const &positions = simulationFrames.front().positions;
+  if (quantizedPositions && !positions.empty()) {
+    fitPositionBox();
+  } else {
+    positionOrigin = Vec3f(0, 0, 0);
+    positionScale = Vec3f(1, 1, 1);
+  }
+
+  if (massBuffer.reserve(positions.size() + 1))
+    setupVAO();
+  void *verts = massBuffer.map();
+
+  if (DEBUG == true) {
+    for (unsigned i = 0; i < positions.size(); ++i)
+      std::cout << "points[" << i << "] = " << positions[i] << std::endl;
+    std::cout << " --- " << std::endl;
+  }
+
+  unsigned count = positions.size();
+  unsigned chunks = (count + uploadChunk - 1) / uploadChunk;
+  renderPool.parallelFor(chunks, [verts, count, &positions](unsigned chunk) {
+    unsigned end = std::min(count, (chunk + 1) * uploadChunk);
+    for (unsigned i = chunk * uploadChunk; i < end; ++i)
+      storePosition(verts, i, drawnPosition(positions, i));
+  });
+  storePosition(verts, positions.size(), dragTarget);
+  massBuffer.unmap(positions.size() + 1);
+  dragTargetMoved = false;
+}
+
+// Two triangles to each quad of the lattice, split the way ClothCollision
+// splits them.
+void loadSurfaceGeometryToGPU() {
+  std::vector<GLuint> indices;
+  unsigned length = latticeLength;
+  if (latticeLength > 1 && latticeWidth > 1)
+    indices.reserve(6 * (latticeLength - 1) * (latticeWidth - 1));
+  for (unsigned row = 0; row + 1 < latticeWidth; row++) {
+    for (unsigned column = 0; column + 1 < length; column++) {
+      unsigned i = row * length + column;
+      GLuint quad[6] = {i,     i + 1,          i + length,
+                        i + 1, i + length + 1, i + length};
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+  surfaceIndexCount = indices.size();
+
+  glBindVertexArray(surface_vaoID);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, surface_indexBufferID);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(),
+               indices.data(), GL_STATIC_DRAW);
+  glBindVertexArray(0);
+}
+
+bool drawSurface() {
+  return clothSurface && latticeLength > 1 && latticeWidth > 1;
+}
+
+// The springs only change with the scene, so only then are their indices
+// uploaded, with room after them for the spring of the dragged mass. The
+// positions they index are the ones loadQuadGeometryToGPU streams every
+// frame.
 void loadLineGeometryToGPU() {
-  std::vector<Vec3f> verts;
+  std::vector<GLuint> indices;
+  indices.reserve(2 * springs.size() + 2);
   for (unsigned i = 0; i < springs.size(); i++){
-    verts.push_back((springs[i].a)->position);
-    verts.push_back((springs[i].b)->position);
+    indices.push_back(massIndex(springs[i].a));
+    indices.push_back(massIndex(springs[i].b));
   }
+  indices.resize(indices.size() + 2);
 
-  glBindBuffer(GL_ARRAY_BUFFER, line_vertBufferID);
-  glBufferData(GL_ARRAY_BUFFER,
-               sizeof(Vec3f) * 2 * springs.size(), // byte size of Vec3f, 4 of them
-               verts.data(),      // pointer (Vec3f*) to contents of verts
+  glBindVertexArray(line_vaoID);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, line_indexBufferID);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+               sizeof(GLuint) * indices.size(), // byte size of the indices
+               indices.data(),    // pointer (GLuint*) to the indices
                GL_STATIC_DRAW);   // Usage pattern of GPU buffer
+  glBindVertexArray(0);
+
+  loadDragSpringToGPU();
+}
+
+// The spring of the dragged mass changes with a click, and is just the two
+// indices after the springs'; without one, they aren't drawn.
+void loadDragSpringToGPU() {
+  lineIndexCount = 2 * springs.size();
+  if (dragMass < 0)
+    return;
+
+  GLuint ends[2] = {GLuint(dragMass),
+                    GLuint(simulationFrames.front().positions.size())};
+  glBindVertexArray(line_vaoID);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, line_indexBufferID);
+  glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * lineIndexCount,
+                  sizeof(ends), ends);
+  glBindVertexArray(0);
+  lineIndexCount += 2;
 }
 
 void setupVAO() {
@@ -780,21 +2074,50 @@ void setupVAO() {
                         (void *)0 // array buffer offset
                         );
 
+  // mass positions, moving on once per quad rather than per vertex
+  glEnableVertexAttribArray(1);
+  setupMassAttribute();
+  glVertexAttribDivisor(1, 1);
+
+  glBindVertexArray(point_vaoID);
+
+  glEnableVertexAttribArray(0); // match layout # in billboard_vs.glsl
+  pointAtPositions(0, 0);
+
+  // The ends of the springs go where the quads' positions go in basic_vs,
+  // with the corner left at its default of 0.
   glBindVertexArray(line_vaoID);
 
-  glEnableVertexAttribArray(0); // match layout # in shader
-  glBindBuffer(GL_ARRAY_BUFFER, line_vertBufferID);
-  glVertexAttribPointer(0,        // attribute layout # above
-                        3,        // # of components (ie XYZ )
-                        GL_FLOAT, // type of components
-                        GL_FALSE, // need to be normalized?
-                        0,        // stride
-                        (void *)0 // array buffer offset
-                        );
+  glEnableVertexAttribArray(1);
+  pointAtPositions(1, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, line_indexBufferID);
+
+  // The surface reads the positions through the texture buffer rather than
+  // from attributes, one coordinate a texel in the format written.
+  glBindVertexArray(surface_vaoID);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, surface_indexBufferID);
+  glBindTexture(GL_TEXTURE_BUFFER, surface_positionTextureID);
+  glTexBuffer(GL_TEXTURE_BUFFER, quantizedPositions ? GL_R16 : GL_R32F,
+              massBuffer.id());
 
   glBindVertexArray(0); // reset to default
 }
 
+// The positions from the mass buffer, starting at the given one, in the
+// format they were written in.
+void pointAtPositions(GLuint attribute, unsigned first) {
+  glBindBuffer(GL_ARRAY_BUFFER, massBuffer.id());
+  void *offset = (void *)(std::size_t(massBuffer.stride()) * first);
+  if (quantizedPositions)
+    glVertexAttribPointer(attribute, 3, GL_UNSIGNED_SHORT, GL_TRUE, 0, offset);
+  else
+    glVertexAttribPointer(attribute, 3, GL_FLOAT, GL_FALSE, 0, offset);
+}
+
+// Points the position of each quad at the masses of this frame, which
+// start at a different place of the buffer every frame.
+void setupMassAttribute() { pointAtPositions(1, massBuffer.first()); }
+
 void reloadProjectionMatrix() {
   // Perspective Only
 
@@ -811,57 +2134,93 @@ void reloadProjectionMatrix() {
 }
 
 void loadModelViewMatrix() {
-  M = IdentityMatrix();
-  line_M = IdentityMatrix();
   // view doesn't change, but if it did you would use this
   V = camera.lookatMatrix();
 }
 
 void reloadViewMatrix() { V = camera.lookatMatrix(); }
 
-void setupModelViewProjectionTransform() {
-  MVP = P * V * M; // transforms vertices from right to left (odd huh?)
-}
-
-void reloadMVPUniform() {
-  GLint id = glGetUniformLocation(basicProgramID, "MVP");
-
-  glUseProgram(basicProgramID);
-  glUniformMatrix4fv(id,        // ID
-                     1,         // only 1 matrix
-                     GL_TRUE,   // transpose matrix, Mat4f is row major
-                     MVP.data() // pointer to data in Mat4f
-                     );
-}
-
-void reloadColorUniform(float r, float g, float b) {
-  GLint id = glGetUniformLocation(basicProgramID, "inputColor");
+// Once a frame, into the Frame block every program reads. The camera's
+// directions are the rows of V, the view looking down the third one.
+void loadFrameToGPU() {
+  FrameBlock block = {};
+  Mat4f VP = P * V;
+  for (int n = 0; n < 16; n++) {
+    block.V[n] = V.data()[n];
+    block.P[n] = P.data()[n];
+    block.VP[n] = VP.data()[n];
+  }
+  for (int axis = 0; axis < 3; axis++) {
+    block.cameraRight[axis] = V(0, axis);
+    block.cameraUp[axis] = V(1, axis);
+    block.cameraForward[axis] = -V(2, axis);
+    block.positionOrigin[axis] = positionOrigin[axis];
+    block.positionScale[axis] = positionScale[axis];
+  }
+  block.lattice[0] = latticeLength;
+  block.lattice[1] = latticeWidth;
+  block.lattice[2] = massBuffer.first();
 
-  glUseProgram(basicProgramID);
-  glUniform3f(id, // ID in basic_vs.glsl
-              r, g, b);
+  glBindBuffer(GL_UNIFORM_BUFFER, frameBufferID);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
 }
 
 void generateIDs() {
   // shader ID from OpenGL
   std::string vsSource = loadShaderStringfromFile("./shaders/basic_vs.glsl");
   std::string fsSource = loadShaderStringfromFile("./shaders/basic_fs.glsl");
-  basicProgramID = CreateShaderProgram(vsSource, fsSource);
+  basicProgram.create(vsSource, fsSource);
+
+  std::string billboardVs =
+      loadShaderStringfromFile("./shaders/billboard_vs.glsl");
+  std::string billboardGs =
+      loadShaderStringfromFile("./shaders/billboard_gs.glsl");
+  billboardProgram.create(billboardVs, billboardGs, fsSource);
+
+  std::string surfaceVs = loadShaderStringfromFile("./shaders/surface_vs.glsl");
+  surfaceProgram.create(surfaceVs, fsSource);
+
+  massMaterial = Material(&basicProgram, 0.5, 0, 1, masswidth);
+  springMaterial = Material(&basicProgram, 0.2, 0.2, 0.2, 1);
+  billboardMaterial = Material(&billboardProgram, 0.5, 0, 1, masswidth);
+  surfaceMaterial = Material(&surfaceProgram, 0.5, 0, 1, 1);
+
+  // the frame block, bound once for good
+  glGenBuffers(1, &frameBufferID);
+  glBindBuffer(GL_UNIFORM_BUFFER, frameBufferID);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), NULL, GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, ShaderProgram::FRAME_BINDING,
+                   frameBufferID);
 
   // VAO and buffer IDs given from OpenGL
   glGenVertexArrays(1, &vaoID);
   glGenBuffers(1, &vertBufferID);
+  massBuffer.create();
+  glGenVertexArrays(1, &point_vaoID);
+  massTimer.create();
   glGenVertexArrays(1, &line_vaoID);
-  glGenBuffers(1, &line_vertBufferID);
+  glGenBuffers(1, &line_indexBufferID);
+  glGenVertexArrays(1, &surface_vaoID);
+  glGenBuffers(1, &surface_indexBufferID);
+  glGenTextures(1, &surface_positionTextureID);
 }
 
 void deleteIDs() {
-  glDeleteProgram(basicProgramID);
+  basicProgram.destroy();
+  billboardProgram.destroy();
+  surfaceProgram.destroy();
+  glDeleteBuffers(1, &frameBufferID);
 
   glDeleteVertexArrays(1, &vaoID);
   glDeleteBuffers(1, &vertBufferID);
+  massBuffer.destroy();
+  glDeleteVertexArrays(1, &point_vaoID);
+  massTimer.destroy();
   glDeleteVertexArrays(1, &line_vaoID);
-  glDeleteBuffers(1, &line_vertBufferID);
+  glDeleteBuffers(1, &line_indexBufferID);
+  glDeleteVertexArrays(1, &surface_vaoID);
+  glDeleteBuffers(1, &surface_indexBufferID);
+  glDeleteTextures(1, &surface_positionTextureID);
 }
 
 void init() {
@@ -871,24 +2230,30 @@ void init() {
   camera = Camera(Vec3f{0, -25, 50}, Vec3f{0, 0, -1}, Vec3f{0, 1, 0});
 
   setupPoints();
+  publishFrame();
+  simulationFrames.acquire();
+  previousFrame = simulationFrames.front();
 
   // SETUP SHADERS, BUFFERS, VAOs
 
   generateIDs();
   setupVAO();
-  loadQuadGeometryToGPU(masswidth);
+  loadUnitQuadToGPU();
+  loadQuadGeometryToGPU();
   loadLineGeometryToGPU();
+  loadSurfaceGeometryToGPU();
 
   loadModelViewMatrix();
   reloadProjectionMatrix();
-  setupModelViewProjectionTransform();
-  reloadMVPUniform();
 }
 
 int main(int argc, char **argv) {
   GLFWwindow *window;
 
-
+  if (!parseArguments(argc, argv))
+    return EXIT_FAILURE;
+  if (headless)
+    return runHeadless();
 
   if (!glfwInit()) {
     exit(EXIT_FAILURE);
@@ -927,7 +2292,14 @@ int main(int argc, char **argv) {
   std::cout << "GL Version: :" << glGetString(GL_VERSION) << std::endl;
   std::cout << GL_ERROR() << std::endl;
 
+  if (StreamBuffer::loadPersistentMapping(
+          reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
+    std::cout << "Streaming vertices through mapped buffers" << std::endl;
+  else
+    std::cout << "Streaming vertices by orphaning buffers" << std::endl;
+
   init(); // our own initialize stuff func
+  buildPicker();
 
 
 
@@ -937,68 +2309,169 @@ int main(int argc, char **argv) {
   // ============================ START PROGRAM ============================ //
   // ======================================================================= //
 
-  float t = 0;
-  float dt = 0.0001;
   int currentView = view;
+  simulationThread = std::thread(simulationLoop);
 
   while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
          !glfwWindowShouldClose(window)) {
 
-    if (view == 4 || view == 5)
-      dt = 0.00001;
-    else
-      dt = 0.0001;
-
-    if (currentView != view) {  // change views, restart simulation
-      t = 0;
+    if (currentView != view) {  // changed views, move the camera
       currentView = view;
-
-      if (view == 5) {
-        camera = Camera(Vec3f{-100, -30, 70}, Vec3f{1, 0, -1}, Vec3f{0, 1, 0});
-        reloadViewMatrix();
-
-      }
-      if (view == 4) {
-        camera = Camera(Vec3f{25, -15, 250}, Vec3f{0, 0, -1}, Vec3f{0, 1, 0});
-        reloadViewMatrix();
-      }
-      else if (view < 4) {
-        camera = Camera(Vec3f{0, -25, 50}, Vec3f{0, 0, -1}, Vec3f{0, 1, 0});
-        reloadViewMatrix();
-      }
-
-      loadLineGeometryToGPU();
-      loadQuadGeometryToGPU(masswidth);
+      placeCamera();
     }
-    if (g_play) {
-      if (replay) {
-        t = 0;
-        animatePoints(t);
-        loadLineGeometryToGPU();
-        loadQuadGeometryToGPU(masswidth);
-        replay = false;
-      }
-
-      t += dt;
-      animatePoints(t);
-      loadLineGeometryToGPU();
-      loadQuadGeometryToGPU(masswidth);
 
+    // the latest frame the simulation has finished, if it is a new one,
+    // and the masses on their way to it until they get there
+    // and the end of the drag spring if the cursor moved it
+    if (acquireFrame() || frameBlend < 1 || dragTargetMoved) {
+      updateFrameBlend();
+      loadQuadGeometryToGPU();
     }
 
     displayFunc();
+    reportMassTimer();
     moveCamera();
+    if (dragMass >= 0)
+      updateDragTarget();
 
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
 
   // clean up after loop
+  simulationQuit = true;
+  simulationThread.join();
   deleteIDs();
 
   return 0;
 }
 
+// Where each view is looked at from.
+void placeCamera() {
+  if (view == 5) {
+    camera = Camera(Vec3f{-100, -30, 70}, Vec3f{1, 0, -1}, Vec3f{0, 1, 0});
+    reloadViewMatrix();
+
+  }
+  if (view == 4) {
+    camera = Camera(Vec3f{25, -15, 250}, Vec3f{0, 0, -1}, Vec3f{0, 1, 0});
+    reloadViewMatrix();
+  }
+  else if (view < 4) {
+    camera = Camera(Vec3f{0, -25, 50}, Vec3f{0, 0, -1}, Vec3f{0, 1, 0});
+    reloadViewMatrix();
+  }
+  else if (view == 6) {
+    camera = Camera(Vec3f{35, -10, 90}, Vec3f{0, -0.3, -1}, Vec3f{0, 1, 0});
+    reloadViewMatrix();
+  }
+}
+
+// Takes --view, and --headless with its options. Returns false, with the
+// usage printed, on anything else, or on an option of --headless without it.
+bool parseArguments(int argc, char **argv) {
+  bool headlessOption = false;
+  bool known = true;
+  for (int a = 1; a < argc && known; a++) {
+    char const *arg = argv[a];
+    char rest;
+    bool option =
+        std::sscanf(arg, "--size=%dx%d%c", &headlessWidth, &headlessHeight,
+                    &rest) == 2 ||
+        std::sscanf(arg, "--frames=%d%c", &headlessFrames, &rest) == 1 ||
+        std::sscanf(arg, "--samples=%d%c", &headlessSamples, &rest) == 1;
+    if (std::strncmp(arg, "--out=", 6) == 0) {
+      headlessPrefix = arg + 6;
+      option = true;
+    }
+    headlessOption = headlessOption || option;
+    headless = headless || std::strcmp(arg, "--headless") == 0;
+
+    known = option || std::strcmp(arg, "--headless") == 0 ||
+            std::sscanf(arg, "--view=%d%c", &view, &rest) == 1;
+  }
+
+  if (!known || (headlessOption && !headless) || headlessWidth < 1 ||
+      headlessHeight < 1 || headlessFrames < 1 || view < 1 || view > 6) {
+    std::cerr << "usage: " << argv[0] << " [--view=1-6] [--headless"
+              << " [--size=WxH] [--frames=N] [--samples=N]"
+              << " [--out=PREFIX]]" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// The frames of --headless, drawn by displayFunc as they would be in the
+// window. The simulation steps on this thread, once before every frame, so
+// the same arguments always give the same frames.
+int runHeadless() {
+  HeadlessContext context;
+  if (!context.create() ||
+      !gladLoadGLLoader(
+          reinterpret_cast<GLADloadproc>(HeadlessContext::procAddress))) {
+    std::cerr << "Failed to initialise a headless context" << std::endl;
+    return -1;
+  }
+
+  std::cout << "GL Version: :" << glGetString(GL_VERSION) << std::endl;
+  StreamBuffer::loadPersistentMapping(
+      reinterpret_cast<GLADloadproc>(HeadlessContext::procAddress));
+  if (!context.createFramebuffer(headlessWidth, headlessHeight,
+                                 headlessSamples))
+    return -1;
+
+  WIN_WIDTH = FB_WIDTH = headlessWidth;
+  WIN_HEIGHT = FB_HEIGHT = headlessHeight;
+  init();
+  placeCamera();
+
+  std::vector<unsigned char> pixels;
+  double simulating = 0, drawing = 0, writing = 0;
+  for (int f = 0; f < headlessFrames; f++) {
+    double start = wallSeconds();
+    stepSimulation();
+    publishFrame();
+    simulationFrames.acquire();
+
+    double simulated = wallSeconds();
+    loadQuadGeometryToGPU();
+    context.bindFramebuffer();
+    displayFunc();
+    context.readFrame(pixels);  // waits for the frame to be drawn
+
+    double drawn = wallSeconds();
+    if (!headlessPrefix.empty()) {
+      char name[32];
+      std::snprintf(name, sizeof(name), "%04d.ppm", f);
+      std::FILE *file = std::fopen((headlessPrefix + name).c_str(), "wb");
+      if (!file) {
+        std::cerr << "Can't write " << headlessPrefix << name << std::endl;
+        return -1;
+      }
+      std::fprintf(file, "P6 %d %d 255\n", headlessWidth, headlessHeight);
+      std::fwrite(&pixels[0], 1, pixels.size(), file);
+      std::fclose(file);
+    }
+
+    simulating += simulated - start;
+    drawing += drawn - simulated;
+    writing += wallSeconds() - drawn;
+  }
+
+  double total = simulating + drawing + writing;
+  double perFrame = 1000.0 / headlessFrames;
+  std::cout << headlessFrames << " frames of " << headlessWidth << "x"
+            << headlessHeight << " in " << total << " s, "
+            << headlessFrames / total << " frames a second (ms a frame: "
+            << simulating * perFrame << " simulating, " << drawing * perFrame
+            << " drawing and reading back, " << writing * perFrame
+            << " writing)" << std::endl;
+
+  deleteIDs();
+  context.destroy();
+  return 0;
+}
+
 // ======================================================================= //
 // ============================= END PROGRAM ============================= //
 // ======================================================================= //
@@ -1013,8 +2486,6 @@ void windowSetSizeFunc(GLFWwindow *window, int width, int height) {
   WIN_HEIGHT = height;
 
   reloadProjectionMatrix();
-  setupModelViewProjectionTransform();
-  reloadMVPUniform();
 }
 
 void windowSetFramebufferSizeFunc(GLFWwindow *window, int width, int height) {
@@ -1028,22 +2499,32 @@ void windowMouseButtonFunc(GLFWwindow *window, int button, int action,
                            int mods) {
   if (button == GLFW_MOUSE_BUTTON_LEFT) {
     if (action == GLFW_PRESS) {
-      g_cursorLocked = GL_TRUE;
+      if (!startDrag())
+        g_cursorLocked = GL_TRUE;
     } else {
       g_cursorLocked = GL_FALSE;
+      std::lock_guard<std::mutex> lock(dragTargetMutex);
+      dragMass = -1;
     }
+
+    loadDragSpringToGPU();
   }
 }
 
 void windowMouseMotionFunc(GLFWwindow *window, double x, double y) {
+  if (dragMass >= 0) {
+    g_cursorX = x;
+    g_cursorY = y;
+    updateDragTarget();
+    return;
+  }
+
   if (g_cursorLocked) {
     float deltaX = (x - g_cursorX) * 0.01;
     float deltaY = (y - g_cursorY) * 0.01;
     camera.rotateAroundFocus(deltaX, deltaY);
 
     reloadViewMatrix();
-    setupModelViewProjectionTransform();
-    reloadMVPUniform();
   }
 
   g_cursorX = x;
@@ -1058,22 +2539,13 @@ void windowKeyFunc(GLFWwindow *window, int key, int scancode, int action,
     glfwSetWindowShouldClose(window, GL_TRUE);
     break;
   case GLFW_KEY_ENTER:
-    if (view < 5) {
-      set ? 1: view++;
-      setupPoints();
-    }
-    else
-    {
-      set ? 1: view = 1;
-      setupPoints();
-    }
+    restartScene(set ? view : view % 6 + 1);
     break;
   case GLFW_KEY_W:
     g_moveBackForward = set ? 1 : 0;
     break;
   case GLFW_KEY_0:
-    replay = set ? 1 : 0;
-    setupPoints();
+    restartScene(view);
     break;
   case GLFW_KEY_S:
     g_moveBackForward = set ? -1 : 0;
@@ -1108,8 +2580,52 @@ void windowKeyFunc(GLFWwindow *window, int key, int scancode, int action,
     else
       g_rotateLeftRight = set ? -1 : 0;
     break;
+  case GLFW_KEY_I:
+    if (!set) {
+      std::lock_guard<std::mutex> lock(simulationMutex);
+      integrator = integrator == IMEX ? SEMI_IMPLICIT_EULER : IMEX;
+      for (unsigned n = 0; n < islands.size(); n++)
+        islands[n].activeSetsDirty = true;
+      std::cout << (integrator == IMEX ? "IMEX" : "semi-implicit Euler")
+                << " integrator" << std::endl;
+    }
+    break;
+  case GLFW_KEY_B:
+    if (!set) {
+      massRender = massRender == BILLBOARDS ? INSTANCED_QUADS : BILLBOARDS;
+      std::cout << "masses drawn as "
+                << (massRender == BILLBOARDS ? "billboards" : "instanced quads")
+                << std::endl;
+    }
+    break;
+  case GLFW_KEY_P:
+    if (!set) {
+      quantizedPositions = !quantizedPositions;
+      massBuffer.setStride(quantizedPositions ? 3 * sizeof(unsigned short)
+                                              : sizeof(Vec3f));
+      setupVAO();
+      loadQuadGeometryToGPU();
+      std::cout << (quantizedPositions ? "16 bit" : "float")
+                << " positions" << std::endl;
+    }
+    break;
+  case GLFW_KEY_F:
+    if (!set) {
+      clothSurface = !clothSurface;
+      loadQuadGeometryToGPU();
+    }
+    break;
   case GLFW_KEY_SPACE:
-    g_play = set ? !g_play : g_play;
+    if (set)
+      g_play = !g_play;
+    break;
+  case GLFW_KEY_MINUS:
+  case GLFW_KEY_EQUAL:
+    if (!set) {
+      simulationRate = simulationRate * (key == GLFW_KEY_MINUS ? 0.5f : 2.f);
+      std::cout << "simulating " << simulationRate << " frames a second"
+                << std::endl;
+    }
     break;
   case GLFW_KEY_LEFT_BRACKET:
     if (mods == GLFW_MOD_SHIFT) {
@@ -1132,6 +2648,20 @@ void windowKeyFunc(GLFWwindow *window, int key, int scancode, int action,
 
 //==================== OPENGL HELPER FUNCTIONS ====================//
 
+void reportMassTimer() {
+  double now = glfwGetTime();
+  if (now - lastTimerReport < timerReportPeriod)
+    return;
+  lastTimerReport = now;
+
+  char const *name = drawSurface() ? "cloth surface"
+                     : massRender == BILLBOARDS ? "billboards"
+                                                : "instanced quads";
+  double ms = massTimer.average();
+  if (ms >= 0)
+    std::cout << name << ": " << ms << " ms/frame on the GPU" << std::endl;
+}
+
 void moveCamera() {
   Vec3f dir;
 
@@ -1159,11 +2689,96 @@ void moveCamera() {
       g_rotateLeftRight || g_rotateUpDown || g_rotateRoll) {
     camera.move(dir);
     reloadViewMatrix();
-    setupModelViewProjectionTransform();
-    reloadMVPUniform();
   }
 }
 
+// The ray from the camera through the cursor, in world space: the cursor
+// as a point on the near plane in view space, turned back by the rotation of
+// V, which is its own inverse transposed.
+void cursorRay(Vec3f &origin, Vec3f &direction) {
+  float x = 2 * g_cursorX / WIN_WIDTH - 1;
+  float y = 1 - 2 * g_cursorY / WIN_HEIGHT;
+  float view[3] = {x / P(0, 0), y / P(1, 1), -1};
+
+  for (int axis = 0; axis < 3; axis++) {
+    float sum = 0;
+    for (int row = 0; row < 3; row++)
+      sum += V(row, axis) * view[row];
+    direction[axis] = sum;
+  }
+  direction.normalize();
+  origin = camera.position();
+}
+
+// Sets both pickers up for the scene just loaded, around the masses of the
+// frame it published. The springs' ends and which masses are fixed only
+// change with the scene, so they can be read while the simulation runs.
+void buildPicker() {
+  std::vector<unsigned> ends(2 * springs.size());
+  for (unsigned i = 0; i < springs.size(); i++) {
+    ends[2 * i] = massIndex(springs[i].a);
+    ends[2 * i + 1] = massIndex(springs[i].b);
+  }
+  for (int n = 0; n < 2; n++) {
+    pickers[n].setRadius(pickRadius);
+    pickers[n].build(simulationFrames.front().positions, ends, renderPool);
+  }
+
+  std::lock_guard<std::mutex> lock(pickerMutex);
+  currentPicker = 0;
+  pickersBuilt = true;
+}
+
+// Fits the spare picker to the masses of the frame about to be published,
+// on the simulation's pool, and makes it the one clicks pick with. Nothing
+// to do before the scene's pickers are built, which headless they never are.
+void refitPicker(std::vector<Vec3f> const &positions) {
+  unsigned spare;
+  {
+    std::lock_guard<std::mutex> lock(pickerMutex);
+    if (!pickersBuilt)
+      return;
+    spare = 1 - currentPicker;
+  }
+  pickers[spare].refit(positions, threadPool);
+
+  std::lock_guard<std::mutex> lock(pickerMutex);
+  currentPicker = spare;
+}
+
+// Grabs the mass under the cursor, if there is one that can move, with the
+// picker fitted to the last frame the simulation published.
+bool startDrag() {
+  Vec3f origin, direction;
+  cursorRay(origin, direction);
+  float distance;
+  int mass = -1;
+  {
+    std::lock_guard<std::mutex> lock(pickerMutex);
+    if (pickersBuilt)
+      mass = pickers[currentPicker].pick(origin, direction, distance);
+  }
+  if (mass < 0 || points[mass].fixed)
+    return false;
+
+  {
+    std::lock_guard<std::mutex> lock(dragTargetMutex);
+    dragMass = mass;
+  }
+  dragDistance = distance;
+  updateDragTarget();
+  return true;
+}
+
+// Keeps the target under the cursor as it and the camera move.
+void updateDragTarget() {
+  Vec3f origin, direction;
+  cursorRay(origin, direction);
+  std::lock_guard<std::mutex> lock(dragTargetMutex);
+  dragTarget = origin + direction * dragDistance;
+  dragTargetMoved = true;
+}
+
 std::string GL_ERROR() {
   GLenum code = glGetError();
 